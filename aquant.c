@@ -261,29 +261,34 @@ double get_double(const char *prompt)
 
 // --- Original Integer Array Functions ---
 // ... (array_max, array_min, array_sum, etc. - unchanged) ...
+// The reductions accumulate in locals rather than through the result pointer,
+// which may alias `arr`; that keeps the loops free of stores so they vectorize.
 bool array_max(const int *arr, size_t size, int *max_val) {
     if (arr == NULL || size == 0 || max_val == NULL) return false;
-    *max_val = arr[0];
+    int best = arr[0];
     for (size_t i = 1; i < size; ++i) {
-        if (arr[i] > *max_val) *max_val = arr[i];
+        best = arr[i] > best ? arr[i] : best;
     }
+    *max_val = best;
     return true;
 }
 
 bool array_min(const int *arr, size_t size, int *min_val) {
     if (arr == NULL || size == 0 || min_val == NULL) return false;
-    *min_val = arr[0];
+    int best = arr[0];
     for (size_t i = 1; i < size; ++i) {
-        if (arr[i] < *min_val) *min_val = arr[i];
+        best = arr[i] < best ? arr[i] : best;
     }
+    *min_val = best;
     return true;
 }
 
 bool array_sum(const int *arr, size_t size, long long *sum) {
     if (sum == NULL) return false;
     if (arr == NULL || size == 0) { *sum = 0; return true; }
-    *sum = 0;
-    for (size_t i = 0; i < size; ++i) { *sum += arr[i]; }
+    long long total = 0;
+    for (size_t i = 0; i < size; ++i) { total += arr[i]; }
+    *sum = total;
     return true;
 }
 
@@ -1122,6 +1127,273 @@ double string_to_double(const string s, bool *success) {
 }
 
 
+// O(L) time. Copies a length-delimited range, e.g. a token inside a larger buffer. Caller must free.
+string string_copy_n(const char *s, size_t length) {
+    if (s == NULL) return NULL;
+    string copy = malloc(length + 1);
+    if (copy == NULL) return NULL;
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// O(L) time. Like string_to_double + string_is_int on a length-delimited range, without allocating:
+// optional surrounding whitespace, optional sign, then decimal digits only.
+int string_n_to_int(const char *s, size_t length, bool *success) {
+    if (success) *success = false;
+    if (s == NULL) return 0;
+    size_t i = 0;
+    while (i < length && isspace((unsigned char)s[i])) i++;
+    while (length > i && isspace((unsigned char)s[length - 1])) length--;
+    bool negative = false;
+    if (i < length && (s[i] == '+' || s[i] == '-')) { negative = (s[i] == '-'); i++; }
+    if (i == length) return 0;
+    long long value = 0;
+    for (; i < length; ++i) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        value = value * 10 + (s[i] - '0');
+        if (value > (long long)INT_MAX + 1) return 0;
+    }
+    if (negative) value = -value;
+    if (value > INT_MAX || value < INT_MIN) return 0;
+    if (success) *success = true;
+    return (int)value;
+}
+
+// O(L) time. string_to_double on a length-delimited range. Short ranges are copied
+// to the stack for strtod; only ranges of 64 bytes or more allocate.
+double string_n_to_double(const char *s, size_t length, bool *success) {
+    if (success) *success = false;
+    if (s == NULL) return 0.0;
+    char local[64];
+    char *copy = length < sizeof(local) ? local : malloc(length + 1);
+    if (copy == NULL) return 0.0;
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    double value = string_to_double(copy, success);
+    if (copy != local) free(copy);
+    return value;
+}
+
+
+// --- String Buffer Functions ---
+// O(1) time.
+void string_buffer_init(string_buffer *sb) {
+    sb->data = NULL;
+    sb->length = 0;
+    sb->capacity = 0;
+}
+
+// Amortized O(1) time. Ensures room for `extra` more bytes plus the terminating NUL.
+bool string_buffer_reserve(string_buffer *sb, size_t extra) {
+    size_t needed = sb->length + extra + 1;
+    if (needed <= sb->capacity) return true;
+    size_t new_capacity = (sb->capacity == 0) ? 64 : sb->capacity;
+    while (new_capacity < needed) new_capacity *= 2;
+    char *temp = realloc(sb->data, new_capacity);
+    if (temp == NULL) return false;
+    sb->data = temp;
+    sb->capacity = new_capacity;
+    return true;
+}
+
+// O(L) time.
+bool string_buffer_append_n(string_buffer *sb, const char *s, size_t length) {
+    if (!string_buffer_reserve(sb, length)) return false;
+    memcpy(sb->data + sb->length, s, length);
+    sb->length += length;
+    sb->data[sb->length] = '\0';
+    return true;
+}
+
+// O(L) time. NULL appends nothing.
+bool string_buffer_append(string_buffer *sb, const char *s) {
+    return s == NULL || string_buffer_append_n(sb, s, strlen(s));
+}
+
+// Amortized O(1) time.
+bool string_buffer_append_char(string_buffer *sb, char c) {
+    if (!string_buffer_reserve(sb, 1)) return false;
+    sb->data[sb->length++] = c;
+    sb->data[sb->length] = '\0';
+    return true;
+}
+
+// O(digits) time.
+bool string_buffer_append_int(string_buffer *sb, int value) {
+    char digits[12];
+    size_t pos = sizeof(digits);
+    unsigned int magnitude = (value < 0) ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[--pos] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) digits[--pos] = '-';
+    return string_buffer_append_n(sb, digits + pos, sizeof(digits) - pos);
+}
+
+// O(1) time.
+void string_buffer_clear(string_buffer *sb) {
+    sb->length = 0;
+    if (sb->data) sb->data[0] = '\0';
+}
+
+void string_buffer_free(string_buffer *sb) {
+    free(sb->data);
+    string_buffer_init(sb);
+}
+
+// --- Arena Allocator Functions ---
+struct arena_block {
+    arena_block *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+struct arena_free_node {
+    arena_free_node *next;
+};
+
+// Header of an allocation too large for a size class; the caller's bytes follow.
+struct arena_large {
+    arena_large *prev;
+    arena_large *next;
+    char data[];
+};
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+static size_t arena_round_up(size_t size) {
+    if (size == 0) size = 1;
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// Size class of a rounded size, or ARENA_SIZE_CLASSES if it is a large allocation.
+static size_t arena_size_class(size_t rounded) {
+    size_t size_class = rounded / ARENA_ALIGNMENT - 1;
+    return size_class < ARENA_SIZE_CLASSES ? size_class : ARENA_SIZE_CLASSES;
+}
+
+// O(1) time.
+void arena_init(arena *a, size_t block_size) {
+    a->blocks = NULL;
+    a->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    for (size_t i = 0; i < ARENA_SIZE_CLASSES; i++) a->free_lists[i] = NULL;
+    a->large = NULL;
+}
+
+// O(1) time. Large requests are their own malloc, linked at the head of `a->large`.
+void *arena_alloc(arena *a, size_t size) {
+    size_t rounded = arena_round_up(size);
+    size_t size_class = arena_size_class(rounded);
+    if (size_class == ARENA_SIZE_CLASSES) {
+        arena_large *large = malloc(sizeof(arena_large) + rounded);
+        if (large == NULL) return NULL;
+        large->prev = NULL;
+        large->next = a->large;
+        if (a->large != NULL) a->large->prev = large;
+        a->large = large;
+        return large->data;
+    }
+    if (a->free_lists[size_class] != NULL) {
+        arena_free_node *node = a->free_lists[size_class];
+        a->free_lists[size_class] = node->next;
+        return node;
+    }
+    arena_block *head = a->blocks;
+    if (head != NULL && head->capacity - head->used >= rounded) {
+        void *p = head->data + head->used;
+        head->used += rounded;
+        return p;
+    }
+    size_t block_size = a->block_size ? a->block_size : ARENA_DEFAULT_BLOCK_SIZE;
+    if (block_size < rounded) block_size = rounded;
+    arena_block *block = malloc(sizeof(arena_block) + block_size);
+    if (block == NULL) return NULL;
+    block->used = rounded;
+    block->capacity = block_size;
+    block->next = head;
+    a->blocks = block;
+    return block->data;
+}
+
+// O(1) time. Small blocks go on their size-class free list for the next
+// arena_alloc of that class; large ones are unlinked and freed right away.
+void arena_free(arena *a, void *p, size_t size) {
+    if (p == NULL) return;
+    size_t size_class = arena_size_class(arena_round_up(size));
+    if (size_class == ARENA_SIZE_CLASSES) {
+        arena_large *large = (arena_large *)((char *)p - offsetof(arena_large, data));
+        if (large->prev != NULL) large->prev->next = large->next;
+        else a->large = large->next;
+        if (large->next != NULL) large->next->prev = large->prev;
+        free(large);
+        return;
+    }
+    arena_free_node *node = p;
+    node->next = a->free_lists[size_class];
+    a->free_lists[size_class] = node;
+}
+
+// O(L) time.
+string arena_copy_n(arena *a, const char *s, size_t length) {
+    char *copy = arena_alloc(a, length + 1);
+    if (copy == NULL) return NULL;
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// O(blocks, freed blocks and large allocations in src) time. dst keeps allocating
+// from its own head block.
+void arena_merge(arena *dst, arena *src) {
+    if (src->blocks != NULL) {
+        arena_block *tail = src->blocks;
+        while (tail->next != NULL) tail = tail->next;
+        if (dst->blocks == NULL) {
+            dst->blocks = src->blocks;
+        } else {
+            tail->next = dst->blocks->next;
+            dst->blocks->next = src->blocks;
+        }
+    }
+    for (size_t i = 0; i < ARENA_SIZE_CLASSES; i++) {
+        arena_free_node *node = src->free_lists[i];
+        while (node != NULL) {
+            arena_free_node *next = node->next;
+            node->next = dst->free_lists[i];
+            dst->free_lists[i] = node;
+            node = next;
+        }
+    }
+    if (src->large != NULL) {
+        arena_large *tail = src->large;
+        while (tail->next != NULL) tail = tail->next;
+        tail->next = dst->large;
+        if (dst->large != NULL) dst->large->prev = tail;
+        dst->large = src->large;
+    }
+    arena_init(src, src->block_size);
+}
+
+// O(blocks + large allocations) time, independent of how many small allocations were made.
+void arena_release(arena *a) {
+    arena_block *block = a->blocks;
+    while (block != NULL) {
+        arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena_large *large = a->large;
+    while (large != NULL) {
+        arena_large *next = large->next;
+        free(large);
+        large = next;
+    }
+    arena_init(a, a->block_size);
+}
+
 // --- More Input/Output Functions ---
 // ... (get_int_range, get_string_non_empty, print_float_array, etc. - unchanged) ...
 int get_int_range(const char *prompt, int min, int max) {
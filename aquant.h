@@ -107,6 +107,48 @@ bool string_starts_with(const string s, const string prefix);
 bool string_ends_with(const string s, const string suffix);
 float string_to_float(const string s, bool *success);
 double string_to_double(const string s, bool *success);
+string string_copy_n(const char *s, size_t length); // Copies `length` bytes (no NUL needed in source). Caller must free result
+int string_n_to_int(const char *s, size_t length, bool *success); // Parses exactly `length` bytes, no allocation
+double string_n_to_double(const char *s, size_t length, bool *success); // string_to_double on exactly `length` bytes
+
+// --- String Buffer (growable, caller-owned) ---
+typedef struct {
+    char *data;      // NUL-terminated whenever length > 0
+    size_t length;
+    size_t capacity;
+} string_buffer;
+void string_buffer_init(string_buffer *sb);
+bool string_buffer_reserve(string_buffer *sb, size_t extra); // Amortized O(1) growth
+bool string_buffer_append(string_buffer *sb, const char *s);
+bool string_buffer_append_n(string_buffer *sb, const char *s, size_t length);
+bool string_buffer_append_char(string_buffer *sb, char c);
+bool string_buffer_append_int(string_buffer *sb, int value); // No printf format parsing
+void string_buffer_clear(string_buffer *sb); // Keeps capacity for reuse
+void string_buffer_free(string_buffer *sb);
+
+// --- Arena Allocator (region-based, caller-owned) ---
+// Reuse policy: allocations up to ARENA_ALIGNMENT * ARENA_SIZE_CLASSES bytes are
+// bumped from shared blocks, and a freed one goes on its size class's free list for
+// the next allocation of that class. Larger allocations are separate mallocs, kept on
+// a list so arena_release still frees them; arena_free returns them to malloc at once.
+// Either way freed memory is reused, so churn does not grow the arena without bound.
+#define ARENA_ALIGNMENT 8
+#define ARENA_SIZE_CLASSES 32
+typedef struct arena_block arena_block;
+typedef struct arena_free_node arena_free_node;
+typedef struct arena_large arena_large;
+typedef struct {
+    arena_block *blocks;     // Newest first; allocation bumps through the head block
+    size_t block_size;       // 0 selects a default, so a zero-initialized arena is ready to use
+    arena_free_node *free_lists[ARENA_SIZE_CLASSES]; // Freed blocks by size class
+    arena_large *large;      // Live allocations too big for a size class, doubly linked
+} arena;
+void arena_init(arena *a, size_t block_size);
+void *arena_alloc(arena *a, size_t size); // O(1). Reuses a freed block of the same size class first
+void arena_free(arena *a, void *p, size_t size); // O(1). `size` must match the allocation, and `a` must be its arena or one it was merged into
+string arena_copy_n(arena *a, const char *s, size_t length); // Like string_copy_n, but from the arena. Free with arena_free(a, p, length + 1)
+void arena_merge(arena *dst, arena *src); // Moves all of src's memory into dst, leaving src empty
+void arena_release(arena *a); // Frees everything allocated from `a` at once
 
 // --- Memory Management Helpers ---
 void free_string(string s); // Frees string allocated by aquant functions
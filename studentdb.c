@@ -1,83 +1,646 @@
+#define _POSIX_C_SOURCE 200809L
 #include "aquant.h" 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> 
 #include <ctype.h>  
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdarg.h>
 
 #define DATABASE_FILE "students.csv"
-#define MAX_STUDENTS 100
+#define WAL_FILE "students.wal"
+#define SNAPSHOT_FILE "students.db"
+#define SNAPSHOT_MAGIC "SDBSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_ID_WIDTH (MAX_ID_LENGTH + 1)
+#define WAL_CHECKPOINT_INTERVAL 1000
+#define AUTOSAVE_INTERVAL_MS 200
+#define AUTOSAVE_MAX_PENDING_BYTES (64 << 10)
+#define CHECKPOINT_POLL_MS 50
+#define TEMP_FILE_SUFFIX ".tmp"
+#define IMPORT_MIN_CHUNK_BYTES (1 << 20)
+#define IMPORT_MAX_THREADS 64
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define OUTPUT_ROW_HEADROOM (64 << 10)
+#define STUDENT_CHUNK_SHIFT 12
+#define STUDENT_CHUNK_SIZE (1 << STUDENT_CHUNK_SHIFT)
+#define STORE_COMPACT_MIN_TOMBSTONES 1024
+#define STORE_COMPACT_STEP 1024
+#define QUERY_MAX_NUMBER 1000000000
+#define RANK_MIN_RECORDS_PER_THREAD (1 << 16)
 #define MAX_ID_LENGTH 25
 #define MAX_SUBJECT_NAME_LENGTH 30
-#define MAX_SEMESTERS 4
-#define MAX_SUBJECTS_PER_SEMESTER 5
+#define DEFAULT_MAX_SEMESTERS 4
+#define DEFAULT_MAX_SUBJECTS_PER_SEMESTER 5
+#define MARKS_LIMIT_CEILING 1000
+#define MAX_MARK 100
+#define MARK_SEMESTER_HEADER 0xFF
+#define MAX_AGE UINT8_MAX
+#define NAME_INLINE_LENGTH 15
+#define NAME_SPILLED '\x01'
+// Separators of the CSV row and MarksData formats, which the log also uses, so
+// typed names, majors and subjects may not contain them.
+#define FIELD_RESERVED_CHARS ",;"
+#define SUBJECT_RESERVED_CHARS ",;:="
 
+// Interned string handle; see SymbolTable. SYMBOL_NONE stands for "no value".
+// Symbols fit in SYMBOL_BITS so a subject and its mark pack into 32 bits.
+typedef uint32_t Symbol;
+#define SYMBOL_NONE 0
+#define SYMBOL_BITS 24
+#define SYMBOL_MAX ((1u << SYMBOL_BITS) - 1)
+
+// One cell of a record's marks. A semester header (mark == MARK_SEMESTER_HEADER,
+// value = semester number) is followed by that semester's subjects (value =
+// subject symbol, mark = 0..MAX_MARK). Semesters appear in ascending order, each
+// at most once; a header with no subjects marks an active but empty semester.
+typedef struct {
+    uint32_t value : SYMBOL_BITS;
+    uint32_t mark : 8;
+} MarkCell;
+
+// A record's marks: `count` cells allocated from record_heap, or NULL if none.
+// Only what a student actually has is stored.
+typedef struct {
+    MarkCell *cells;
+    uint32_t count;
+} MarkList;
+
+// Semester and subject limits applied to input, from STUDENTDB_MAX_SEMESTERS and
+// STUDENTDB_MAX_SUBJECTS. Storage has no limit of its own.
+typedef struct {
+    int max_semesters;
+    int max_subjects_per_semester;
+} MarksLimits;
+
+MarksLimits marks_limits = { DEFAULT_MAX_SEMESTERS, DEFAULT_MAX_SUBJECTS_PER_SEMESTER };
+
+// One semester's run of cells inside a list being normalized.
 typedef struct {
-    string subject_name; 
-    int mark;            
-} SubjectMark;
+    uint32_t semester;
+    uint32_t start;
+    uint32_t length;
+} MarkBlock;
 
+// Growable scratch array of cells, for building a list before it is copied into an arena.
 typedef struct {
-    int semester_number; 
-    SubjectMark subjects[MAX_SUBJECTS_PER_SEMESTER];
-    int num_subjects_taken;
-} SemesterMarks;
+    MarkCell *cells;
+    uint32_t count;
+    uint32_t capacity;
+} MarkBuilder;
 
+// A name of up to NAME_INLINE_LENGTH bytes is stored in `text` itself. A longer
+// one lives in record_heap (or the mapped snapshot): `text` then holds the
+// pointer and its last byte is NAME_SPILLED. Read it with small_name_text().
 typedef struct {
-    string id;
-    string name;
-    int age;
-    string major;
-    SemesterMarks semesters_data[MAX_SEMESTERS];
-    bool semester_active[MAX_SEMESTERS];
+    char text[NAME_INLINE_LENGTH + 1];
+} SmallName;
+
+// Fixed-width record: the ID is stored inline, the major is a symbol and the
+// marks are a variable-length list, so a short-named student with no marks owns
+// no heap memory at all.
+typedef struct {
+    char id[MAX_ID_LENGTH + 1];
+    SmallName name;
+    uint8_t age;
+    Symbol major;
+    MarkList marks;
 } Student;
 
-Student students[MAX_STUDENTS];
-int student_count = 0;
+// STUDENT_CHUNK_SIZE records stored column by column, so a scan streams only
+// the columns it reads: the marks summary touches `marks`, an ID lookup
+// touches `ids`, and the cold `names` column stays out of cache for both.
+typedef struct {
+    char ids[STUDENT_CHUNK_SIZE][MAX_ID_LENGTH + 1];
+    uint8_t ages[STUDENT_CHUNK_SIZE];
+    Symbol majors[STUDENT_CHUNK_SIZE];
+    MarkList marks[STUDENT_CHUNK_SIZE];
+    SmallName names[STUDENT_CHUNK_SIZE];
+} StudentChunk;
+
+// Records live in fixed-size chunks that are never moved once allocated, so
+// pointers from the column accessors stay valid while the store grows. Records
+// are addressed by index; a Student is only a row copy, see student_load().
+// A deleted record stays behind as a tombstone (age 0, ID and marks kept) until
+// a compaction round reclaims it, so `count` includes `tombstones`.
+typedef struct {
+    StudentChunk **chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    int count;
+    int tombstones;
+} StudentStore;
+
+StudentStore student_store = { NULL, 0, 0, 0, 0 };
+
+#define ID_INDEX_EMPTY -1
+#define ID_INDEX_MIN_CAPACITY 64
+
+// Every distinct subject name and major is stored once; records hold its Symbol,
+// an index into `names` (entry 0 is SYMBOL_NONE). `slots` is an open-addressing
+// table of symbols, SYMBOL_NONE when empty, kept at most half full. Interning takes
+// `lock`, so parallel import workers can share the table. Symbols are never freed
+// individually; their text lives in `strings` and goes all at once. symbol_name()
+// reads without the lock, so it must not race an import; a snapshot fork holds
+// it for reading so the child never inherits a table mid-growth.
+typedef struct {
+    string *names;
+    arena strings;
+    size_t count;
+    size_t capacity;
+    Symbol *slots;
+    size_t slot_capacity;
+    pthread_rwlock_t lock;
+} SymbolTable;
+
+SymbolTable symbols = { NULL, { NULL, 0, { NULL }, NULL }, 0, 0, NULL, 0, PTHREAD_RWLOCK_INITIALIZER };
+
+// Open-addressing hash table (linear probing) from student ID to record index.
+// Capacity is a power of two and is kept at most half full.
+typedef struct {
+    int *slots;
+    size_t capacity;
+    size_t size;
+} IdIndex;
+
+IdIndex id_index = { NULL, 0, 0 };
+
+// Record indices kept sorted ascending by ID (strcmp order). All IDs sharing a
+// prefix form one contiguous run, so a prefix query is two binary searches.
+typedef struct {
+    int *entries;
+    size_t size;
+    size_t capacity;
+    bool deferred; // Set during bulk work: not maintained until id_order_build() rebuilds it.
+} IdOrderIndex;
+
+IdOrderIndex id_order = { NULL, 0, 0, false };
+
+typedef struct {
+    int mark;
+    int record;
+} MarkPosting;
+
+// All (mark, record) pairs for one subject in one semester, sorted ascending by
+// mark then record, so ">= X" is a binary search followed by a walk to the end.
+typedef struct {
+    int semester_number;
+    Symbol subject;
+    MarkPosting *postings;
+    size_t size;
+    size_t capacity;
+} PostingList;
+
+// Inverted index keyed by (semester, subject). `slots` is an open-addressing
+// table of positions in `lists`, or ID_INDEX_EMPTY.
+typedef struct {
+    PostingList *lists;
+    size_t list_count;
+    size_t list_capacity;
+    int *slots;
+    size_t slot_capacity;
+    bool deferred; // Set during bulk work: not maintained until mark_index_build() rebuilds it.
+} MarkIndex;
+
+MarkIndex mark_index = { NULL, 0, 0, NULL, 0, false };
+
+typedef enum { COMPACT_IDLE, COMPACT_PURGE_ORDER, COMPACT_PURGE_MARKS, COMPACT_SLIDE } CompactPhase;
+
+// One compaction round, advanced a bounded step per delete by store_compact_step().
+// It first copies id_order, then each posting list, without the entries of
+// deleted records; `copy` replaces the original once complete. Then it slides
+// the records down over the slots nothing refers to any more.
+typedef struct {
+    CompactPhase phase;
+    size_t list;          // Posting list being copied.
+    size_t cursor;        // Next entry of id_order or that list to copy.
+    void *copy;           // int or MarkPosting entries kept so far; NULL until the copy starts.
+    size_t copy_size;
+    size_t copy_capacity;
+    int read;             // Next record the slide visits.
+    int write;            // Where it goes.
+} StoreCompaction;
+
+StoreCompaction store_compaction = { COMPACT_IDLE, 0, 0, NULL, 0, 0, 0, 0 };
+
+typedef struct {
+    Student student;
+    const char *line;
+    size_t line_length;
+} ImportRow;
+
+// One newline-aligned slice of a CSV being imported, and the rows parsed from it.
+typedef struct {
+    const char *begin;
+    const char *end;
+    const char *source;
+    bool marks_only; // Rows are "ID,MarksData" (see parse_marks_delta_line).
+    arena heap; // Long names and mark lists, merged into record_heap after the import.
+    ImportRow *rows;
+    size_t count;
+    size_t capacity;
+    size_t rejected; // Non-empty rows the parser skipped.
+    bool out_of_memory;
+} ImportChunk;
+
+// Outcome of merge_students_from_file(). Duplicates and rejected count rows; the rest count IDs.
+typedef struct {
+    size_t inserted;
+    size_t updated;
+    size_t unchanged;
+    size_t duplicates; // Exact repeats of a row, dropped.
+    size_t conflicts;  // IDs skipped: differing repeats, unknown IDs or over-full semesters.
+    size_t rejected;   // Rows that failed to parse.
+} MergeReport;
+
+typedef void (*MergeConflictFn)(void *context, const char *id, const char *reason);
+
+// Buffered writer over a raw file descriptor. Callers format straight into `buffer`;
+// it is handed to the kernel in large write()/writev() calls once it fills up.
+typedef struct {
+    int fd;
+    string_buffer buffer;
+    size_t flushed; // Bytes already written to `fd`.
+    bool failed;
+} OutputWriter;
+
+// A file being replaced atomically: `out` is open on `temp_path`, which is renamed
+// over `path` once written. Everything is allocated up front, so a forked child
+// can write and commit it with system calls alone (see fork_frozen_save).
+typedef struct {
+    const char *path;
+    string temp_path;
+    string directory; // Parent of `path`, fsynced after the rename.
+    OutputWriter out;
+} SaveTarget;
+
+typedef bool (*SaveWriter)(SaveTarget *target);
+
+// Held by the main thread while it modifies records or indexes, and around the fork
+// that freezes a view for a checkpoint. The main thread is the only writer, so it reads unlocked.
+pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+// Serializes checkpoints, which may be requested by both threads. Taken before store_lock.
+pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Mutations append log records to `wal_pending` under `wal_lock` and return at once.
+// The autosave thread moves them to `wal_writing` and writes the batch under `wal_io_lock`.
+// Lock order: checkpoint_lock, store_lock, wal_io_lock, wal_lock, then symbols.lock.
+int wal_fd = -1;
+string_buffer wal_pending = { NULL, 0, 0 };
+string_buffer wal_writing = { NULL, 0, 0 };
+int wal_pending_records = 0;
+int wal_records_since_checkpoint = 0;
+struct timespec wal_first_pending;
+// Set when a flush fails; the autosave thread retries once the coalescing window expires.
+bool wal_retry_pending = false;
+pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t wal_io_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t wal_wake = PTHREAD_COND_INITIALIZER;
+// Set in batch mode: records stay buffered and the closing checkpoint writes them all at once.
+bool wal_deferred = false;
+
+typedef struct {
+    pthread_t thread;
+    bool running;
+    bool stop_requested;
+    long interval_ms;         // How long a change may wait before it is written and fsynced.
+    size_t max_pending_bytes; // Write earlier once this much log is buffered.
+} Autosave;
+
+Autosave autosave = { 0 };
+
+// A checkpoint whose snapshot is being written by a forked child.
+typedef struct {
+    pid_t pid;
+    bool saved;         // Result of the in-process fallback when fork failed.
+    off_t wal_cut;      // Log bytes the snapshot covers.
+    int frozen_records; // Log records the snapshot covers.
+} Checkpoint;
+
+// State of one batch run. Results go to `out`, one tab-separated line per command:
+//   ok<TAB>line<TAB>command[<TAB>detail]
+//   error<TAB>line<TAB>command<TAB>message
+// preceded, for queries, by one "row<TAB>line<TAB><CSV row>" line per match.
+typedef struct {
+    FILE *out;
+    string_buffer row;
+    int line;
+    int commands;
+    int failed;
+} BatchContext;
+
+typedef struct {
+    const char *name;
+    bool (*run)(BatchContext *batch, const char *command, char *args);
+} BatchCommand;
+
+// Filter expressions such as `major == "CS" and age < 22 and S2.Math >= 75`
+// compile to a flat program run once per record. Each test sets a result flag;
+// "and"/"or" jump past their right operand once the flag decides the outcome.
+typedef enum {
+    QUERY_CONSTANT,      // value
+    QUERY_ID,            // cmp text
+    QUERY_NAME,          // cmp text
+    QUERY_AGE,           // cmp value
+    QUERY_MAJOR_IS,      // == or != symbol
+    QUERY_MAJOR,         // cmp text
+    QUERY_MARK,          // semester, symbol (subject), cmp value; false if the student has no such mark
+    QUERY_NOT,
+    QUERY_JUMP_IF_FALSE, // value = target
+    QUERY_JUMP_IF_TRUE,  // value = target
+} QueryOp;
+
+typedef enum { QUERY_EQ, QUERY_NE, QUERY_LT, QUERY_LE, QUERY_GT, QUERY_GE } QueryCmp;
+
+typedef struct {
+    uint8_t op;
+    uint8_t cmp;
+    uint16_t semester;
+    Symbol symbol;
+    int32_t value;
+    char *text;
+} QueryInstr;
+
+typedef struct {
+    QueryInstr *code;
+    size_t count;
+    size_t capacity;
+    // Positions in `code` of tests every match must pass (not under "or" or
+    // "not") that an index can answer: ID comparisons and marks.
+    size_t *hints;
+    size_t hint_count;
+    size_t hint_capacity;
+} Query;
+
+// Running totals for one subject over every mark recorded in it, in any semester.
+typedef struct {
+    Symbol subject;
+    size_t count;
+    long long sum;
+    long long sum_squares;
+    int min;
+    int max;
+} SubjectStats;
+
+// One semester of one student. GPA is the mean grade point (see grade_point),
+// every subject weighted equally since credits are not recorded.
+typedef struct {
+    int semester;
+    int subjects;
+    double average;
+    double gpa;
+} SemesterGrades;
+
+// A student's results; `average`, `cgpa`, `min` and `max` cover every mark,
+// and are NAN (or 0) when there are none. `semesters` lists only semesters with marks.
+typedef struct {
+    int subjects;
+    double average;
+    double cgpa;
+    int min;
+    int max;
+    const SemesterGrades *semesters;
+    size_t semester_count;
+} StudentGrades;
+
+// Scratch space for student_grades(), reused across students.
+typedef struct {
+    int *marks;
+    int *points;
+    SemesterGrades *semesters;
+    size_t capacity;
+} GradeBuffer;
+
+typedef void (*StudentGradesFn)(void *context, int record, const StudentGrades *grades);
+
+// What a top/bottom-K ranking orders students by; see rank_compile.
+typedef enum {
+    RANK_AGE,
+    RANK_AVERAGE,          // every mark
+    RANK_CGPA,             // every mark, as grade points
+    RANK_MARK,             // semester, subject
+    RANK_SEMESTER_AVERAGE, // semester
+    RANK_SEMESTER_GPA,     // semester
+} RankMetricKind;
+
+typedef struct {
+    RankMetricKind kind;
+    int semester;
+    Symbol subject;
+} RankMetric;
+
+typedef struct {
+    double value;
+    int record;
+} RankEntry;
+
+// Binary snapshot layout: this header, then one 8-byte aligned column per field
+// (see snapshot_layout), then a heap of NUL-terminated names and symbol strings.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t id_width;
+    uint32_t symbol_count;
+    uint64_t record_count;
+    uint64_t mark_cell_count;
+    uint64_t heap_size;
+} SnapshotHeader;
+
+typedef struct {
+    size_t ids;                // char[n][SNAPSHOT_ID_WIDTH], NUL-padded
+    size_t ages;               // int32_t[n]
+    size_t name_offsets;       // uint32_t[n], into the heap
+    size_t majors;             // Symbol[n]
+    size_t mark_offsets;       // uint32_t[n + 1], record i's cells are [offsets[i], offsets[i + 1])
+    size_t mark_cells;         // uint32_t[mark_cell_count], value | mark << SYMBOL_BITS
+    size_t symbol_offsets;     // uint32_t[symbol_count], heap offset of symbols 1..symbol_count
+    size_t heap;
+    size_t total;
+} SnapshotLayout;
+
+// Long names and mark lists are allocated from this arena, except for names loaded
+// from the snapshot, which point into its mapping. Records give them back with
+// small_name_release() and mark_list_release(); free_all_student_memory() drops
+// the whole arena at once.
+arena record_heap = { NULL, 0, { NULL }, NULL };
+
+// The currently mapped snapshot. Records loaded from it point straight into
+// this mapping, so their strings must go through release_record_string().
+struct {
+    void *base;
+    size_t length;
+} snapshot_map = { NULL, 0 };
 
 void display_menu(void);
+void open_database(FILE *status);
+int run_batch(const char *path);
 void add_student(void);
 void display_all_students(void);
 void display_student_details(const Student *s, bool show_marks);
 void search_student_menu(void);
 void update_student(void);
 void delete_student(void);
+void merge_students_menu(void);
 bool load_students_from_file(const char *filename);
 bool save_students_to_file(const char *filename);
+bool write_students_csv(SaveTarget *target);
 void free_all_student_memory(void);
 void free_student_marks_memory(Student *s); 
+void free_student_record(Student *s);
 int find_student_by_id(const string id);
+bool parse_student_line(const char *line, size_t length, Student *s, const char *source, arena *heap);
+bool parse_marks_delta_line(const char *line, size_t length, Student *s, const char *source, arena *heap);
+bool merge_students_from_file(const char *filename, MergeReport *report, MergeConflictFn on_conflict, void *context);
+bool format_student_line(int index, string_buffer *out);
+
+bool wal_open(const char *filename);
+void wal_close(void);
+bool wal_flush(void);
+void wal_log_upsert(int index);
+void wal_log_delete(const char *id);
+int replay_wal(const char *filename);
+bool checkpoint_database(void);
+void report_checkpoint_failure(const char *what);
+bool save_frozen(SaveWriter writer, const char *path);
+bool autosave_start(void);
+void autosave_stop(void);
+bool write_snapshot(SaveTarget *target);
+bool load_snapshot(const char *filename);
+void release_record_string(string s);
+bool small_name_set(SmallName *name, const char *text, size_t length, arena *strings);
+const char *small_name_text(const SmallName *name);
+void small_name_release(SmallName *name);
+
+const char *student_id(int index);
+const char *student_name(int index);
+int student_age(int index);
+Symbol student_major(int index);
+const MarkList *student_marks(int index);
+void student_load(int index, Student *out);
+void student_store_at(int index, const Student *s);
+void student_release_at(int index);
+bool store_append(const Student *s);
+void store_remove_at(int index);
+void store_compact_step(int budget);
+void store_compact_abort(void);
+void store_compact_order_inserted(size_t pos, int index);
+void store_compact_order_removed(size_t pos, int index);
+void store_compact_posting_inserted(const PostingList *list, size_t pos, MarkPosting posting);
+void store_compact_posting_removed(const PostingList *list, size_t pos, MarkPosting posting);
+void store_release(void);
+bool student_is_live(int index);
+int student_count(void);
+
+bool index_student(int index);
+void unindex_student(int index);
+bool index_student_marks(int index);
+void unindex_student_marks(int index);
+void clear_student_indexes(void);
+int id_index_lookup(const char *id);
+bool id_index_insert(int index);
+bool id_index_reserve(size_t records);
+void id_index_remove(const char *id);
+bool id_order_insert(int index);
+void id_order_remove(int index);
+bool id_order_build(void);
+size_t id_order_prefix_range(const char *prefix, size_t *first);
+size_t id_order_position(const char *id, bool after);
+PostingList *mark_index_find(int semester_number, Symbol subject);
+size_t mark_index_first_at_least(const PostingList *list, int min_mark);
+bool mark_index_add(int semester_number, Symbol subject, int mark, int record);
+void mark_index_remove(int semester_number, Symbol subject, int mark, int record);
+bool mark_index_build(void);
+void mark_index_release(void);
+Symbol symbol_intern_n(const char *name, size_t length);
+Symbol symbol_intern(const char *name);
+Symbol symbol_lookup(const char *name);
+const char *symbol_name(Symbol symbol);
+const char *symbol_text(Symbol symbol, const char *fallback);
+void symbol_table_release(void);
 
 void add_marks_for_student(Student *s);
-void update_marks_for_student(Student *s);
+void update_marks_for_student(int index);
 void display_marks_for_student(const Student *s);
-string format_marks_to_string(const Student *s);
-bool parse_marks_from_string(Student *s, const string marks_str);
+bool format_marks_into(int index, string_buffer *out);
+bool parse_marks_from_string(MarkList *list, const char *marks, size_t length, arena *heap);
 void initialize_student_marks(Student *s); 
+void load_marks_limits(void);
+bool mark_list_find_semester(const MarkList *list, int semester, uint32_t *begin, uint32_t *end);
+bool mark_list_find_mark(const MarkList *list, int semester, Symbol subject, int *mark);
+bool mark_list_insert(const MarkList *list, uint32_t at, const MarkCell *cells, uint32_t n, MarkList *out);
+uint32_t mark_list_subject_count(const MarkList *list);
+uint32_t mark_list_semester_end(const MarkList *list, uint32_t header);
+bool mark_list_copy(const MarkCell *cells, uint32_t count, arena *heap, MarkList *out);
+bool mark_list_merge(const MarkList *base, const MarkList *delta, MarkList *out, int *over_limit);
+int mark_list_over_limit(const MarkList *list);
+void mark_limit_reason(int over_limit, char *reason, size_t size);
+void mark_list_release(MarkList *list);
+MarkCell mark_header_cell(int semester);
+MarkCell mark_subject_cell(Symbol subject, int mark);
+bool mark_cell_is_header(MarkCell cell);
+bool mark_builder_push(MarkBuilder *builder, MarkCell cell);
 
 void search_by_id_prefix_and_sort(void);
-static int compare_students_by_id_desc(const void *a, const void *b);
 void search_by_exact_id(void);
 void search_by_subject_mark(void);
+void search_by_filter(void);
+void reports_menu(void);
+void report_subject_statistics(void);
+void report_student_card(void);
+void report_all_grades(void);
+void report_ranking(bool highest);
+int grade_point(int mark);
+bool student_grades(const MarkList *marks, GradeBuffer *buffer, StudentGrades *out);
+void grade_buffer_free(GradeBuffer *buffer);
+bool marks_aggregate(SubjectStats **subjects, size_t *subject_count, StudentGradesFn on_student, void *context);
+double subject_stats_mean(const SubjectStats *stats);
+double subject_stats_stddev(const SubjectStats *stats);
+bool query_compile(const char *text, Query *query, char *error, size_t error_size);
+bool query_run(const Query *query, int **matches, size_t *count);
+void query_free(Query *query);
+bool rank_compile(const char *text, RankMetric *metric, Query *filter, char *error, size_t error_size);
+bool rank_students(const RankMetric *metric, const Query *filter, size_t k, bool highest, RankEntry **entries, size_t *count);
 
 
 void print_student_table_header(bool with_marks_summary);
-void print_student_row(const Student *s, bool with_marks_summary);
+void print_student_row(int index, bool with_marks_summary);
 void print_student_table_footer(void);
 
 
-int main(void) {
+int main(int argc, char *argv[]) {
     initialize_random(); 
+    load_marks_limits();
 
-    if (load_students_from_file(DATABASE_FILE)) {
-        printf("Loaded %d student(s) from %s\n", student_count, DATABASE_FILE);
-    } else {
-        printf("No existing database file found or error loading. Starting fresh.\n");
+    if (argc > 1) {
+        if (strcmp(argv[1], "--batch") == 0 && argc <= 3) {
+            return run_batch(argc == 3 ? argv[2] : "-");
+        }
+        fprintf(stderr, "Usage: %s [--batch [FILE|-]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    open_database(stdout);
+    if (wal_open(WAL_FILE)) {
+        autosave_start();
     }
 
     int choice;
+    int exit_status = EXIT_SUCCESS;
     do {
         display_menu();
-        choice = get_int_range("Enter your choice: ", 0, 6); 
+        choice = get_int_range("Enter your choice: ", 0, 8); 
 
         switch (choice) {
             case 1: add_student(); break;
@@ -86,26 +649,49 @@ int main(void) {
             case 4: update_student(); break;
             case 5: delete_student(); break;
             case 6:
-                if (save_students_to_file(DATABASE_FILE)) {
-                    printf("Data saved to %s successfully.\n", DATABASE_FILE);
+                if (checkpoint_database() && save_frozen(write_students_csv, DATABASE_FILE)) {
+                    printf("Data saved to %s and exported to %s successfully.\n", SNAPSHOT_FILE, DATABASE_FILE);
                 } else {
-                    printf("Error saving data to %s.\n", DATABASE_FILE);
+                    printf("Error saving data to %s.\n", SNAPSHOT_FILE);
+                }
+                break;
+            case 7: merge_students_menu(); break;
+            case 8: reports_menu(); break;
+            case 0:
+                autosave_stop();
+                if (!checkpoint_database()) {
+                    report_checkpoint_failure("Final save failed!");
+                    exit_status = EXIT_FAILURE;
+                } else if (!save_students_to_file(DATABASE_FILE)) {
+                    fprintf(stderr, "Error: Could not export data to %s.\n", DATABASE_FILE);
                 }
+                printf("Exiting program.\n");
                 break;
-            case 0: printf("Exiting program.\n"); break;
             default: printf("Invalid choice. Please try again.\n"); break;
         }
-        if (choice != 0 && choice != 6) { 
-            printf("Auto-saving data...\n");
-            if (!save_students_to_file(DATABASE_FILE)) {
-                fprintf(stderr, "Error: Auto-save failed!\n");
-            }
-        }
+        // Persistence happens on the autosave thread; the menu comes straight back.
         printf("\n");
     } while (choice != 0);
 
-    free_all_student_memory();
-    return 0;
+    wal_close();
+
+    store_release();
+    return exit_status;
+}
+
+// Loads the snapshot (or imports the CSV) and replays the log, reporting progress on `status`.
+void open_database(FILE *status) {
+    if (load_snapshot(SNAPSHOT_FILE)) {
+        fprintf(status, "Loaded %d student(s) from %s\n", student_count(), SNAPSHOT_FILE);
+    } else if (load_students_from_file(DATABASE_FILE)) {
+        fprintf(status, "Imported %d student(s) from %s\n", student_count(), DATABASE_FILE);
+    } else {
+        fprintf(status, "No existing database file found or error loading. Starting fresh.\n");
+    }
+    int replayed = replay_wal(WAL_FILE);
+    if (replayed > 0) {
+        fprintf(status, "Replayed %d change(s) from %s\n", replayed, WAL_FILE);
+    }
 }
 
 void display_menu(void) {
@@ -116,20 +702,15 @@ void display_menu(void) {
     printf("4. Update Student / Marks\n");
     printf("5. Delete Student\n");
     printf("6. Save Data to File\n");
+    printf("7. Merge CSV File\n");
+    printf("8. Reports (Averages, GPA, Statistics, Rankings)\n");
     printf("0. Exit\n");
     printf("----------------------------------------\n");
 }
 
 void initialize_student_marks(Student *s) {
-    for (int i = 0; i < MAX_SEMESTERS; i++) {
-        s->semesters_data[i].semester_number = i + 1;
-        s->semesters_data[i].num_subjects_taken = 0;
-        s->semester_active[i] = false;
-        for (int j = 0; j < MAX_SUBJECTS_PER_SEMESTER; j++) {
-            s->semesters_data[i].subjects[j].subject_name = NULL;
-            s->semesters_data[i].subjects[j].mark = -1; 
-        }
-    }
+    s->marks.cells = NULL;
+    s->marks.count = 0;
 }
 
 void print_student_table_header(bool with_marks_summary) {
@@ -143,20 +724,14 @@ void print_student_table_header(bool with_marks_summary) {
     printf("-----------------------------------------------------------------------------------\n");
 }
 
-void print_student_row(const Student *s, bool with_marks_summary) {
+void print_student_row(int index, bool with_marks_summary) {
     printf("| %-*s | %-25s | %-3d | %-20s |",
-           MAX_ID_LENGTH, s->id ? s->id : "N/A",
-           s->name ? s->name : "N/A",
-           s->age,
-           s->major ? s->major : "N/A");
+           MAX_ID_LENGTH, student_id(index),
+           student_name(index),
+           student_age(index),
+           symbol_text(student_major(index), "N/A"));
     if (with_marks_summary) {
-        bool has_marks = false;
-        for(int i=0; i < MAX_SEMESTERS; ++i) {
-            if(s->semester_active[i] && s->semesters_data[i].num_subjects_taken > 0) {
-                has_marks = true;
-                break;
-            }
-        }
+        bool has_marks = mark_list_subject_count(student_marks(index)) > 0;
         printf(" %-10s |\n", has_marks ? "Yes" : "No");
     } else {
         printf("\n"); 
@@ -167,18 +742,24 @@ void print_student_table_footer(void) {
     printf("-----------------------------------------------------------------------------------\n");
 }
 
-
-void add_student(void) {
-    if (student_count >= MAX_STUDENTS) {
-        printf("Database is full. Cannot add more students.\n");
-        return;
+// Prompts until the answer contains none of `reserved`. Caller must free the result.
+static string get_field_input(const char *prompt, const char *reserved) {
+    for (;;) {
+        string text = get_string_non_empty(prompt);
+        const char *bad = strpbrk(text, reserved);
+        if (bad == NULL) return text;
+        printf("Error: '%c' is not allowed here (reserved characters: %s).\n", *bad, reserved);
+        free_string(text);
     }
+}
 
+
+void add_student(void) {
     printf("\n--- Add New Student ---\n");
     Student new_student;
     initialize_student_marks(&new_student); 
 
-    new_student.id = NULL; new_student.name = NULL; new_student.major = NULL;
+    new_student.id[0] = '\0'; new_student.name = (SmallName){ { 0 } }; new_student.age = 0; new_student.major = SYMBOL_NONE;
 
     bool id_ok = false;
     string temp_id = NULL;
@@ -194,42 +775,65 @@ void add_student(void) {
         } else if (find_student_by_id(temp_id) != -1) {
             printf("Error: Student ID '%s' already exists.\n", temp_id);
         } else {
-            new_student.id = string_copy(temp_id);
-            if (!new_student.id) { fprintf(stderr, "Memory error copying ID.\n"); free_string(temp_id); return;}
+            memcpy(new_student.id, temp_id, strlen(temp_id) + 1);
             id_ok = true;
         }
     } while (!id_ok);
     if(temp_id) free_string(temp_id);
 
-    new_student.name = get_string_non_empty("Enter Student Name: ");
+    string name = get_field_input("Enter Student Name: ", FIELD_RESERVED_CHARS);
+    bool name_ok = small_name_set(&new_student.name, name, strlen(name), &record_heap);
+    free_string(name);
+    if (!name_ok) {
+        fprintf(stderr, "Memory error copying name. Student not added.\n");
+        return;
+    }
     new_student.age = get_int_range("Enter Student Age: ", 5, 100);
-    new_student.major = get_string_non_empty("Enter Student Major: ");
+    string major = get_field_input("Enter Student Major: ", FIELD_RESERVED_CHARS);
+    new_student.major = symbol_intern(major);
+    free_string(major);
 
-    printf("\n--- Add Marks for Student %s ---\n", new_student.name);
+    printf("\n--- Add Marks for Student %s ---\n", small_name_text(&new_student.name));
     add_marks_for_student(&new_student);
 
-    students[student_count] = new_student; 
-    student_count++;
-    printf("Student %s (ID: %s) added successfully!\n", new_student.name, new_student.id);
+    pthread_mutex_lock(&store_lock);
+    if (!store_append(&new_student)) {
+        pthread_mutex_unlock(&store_lock);
+        fprintf(stderr, "Memory error: could not grow student store. Student not added.\n");
+        free_student_record(&new_student);
+        return;
+    }
+    if (!index_student(student_store.count - 1)) {
+        student_store.count--;
+        pthread_mutex_unlock(&store_lock);
+        fprintf(stderr, "Memory error: could not index student. Student not added.\n");
+        free_student_record(&new_student);
+        return;
+    }
+    wal_log_upsert(student_store.count - 1);
+    pthread_mutex_unlock(&store_lock);
+    printf("Student %s (ID: %s) added successfully!\n", small_name_text(&new_student.name), new_student.id);
 }
 
+// Collects the marks in a scratch builder, then copies exactly that many cells into record_heap.
 void add_marks_for_student(Student *s) {
+    MarkBuilder builder = { NULL, 0, 0 };
+    bool out_of_memory = false;
     char choice_char; 
-    for (int i = 0; i < MAX_SEMESTERS; i++) {
-        printf("Add marks for Semester %d? (y/n): ", i + 1);
+    for (int i = 1; i <= marks_limits.max_semesters && !out_of_memory; i++) {
+        printf("Add marks for Semester %d? (y/n): ", i);
         choice_char = get_char(NULL); 
-        if (choice_char != 'y' && choice_char != 'Y') {
-            s->semester_active[i] = false;
-            continue;
+        if (choice_char != 'y' && choice_char != 'Y') continue;
+        if (!mark_builder_push(&builder, mark_header_cell(i))) {
+            out_of_memory = true;
+            break;
         }
-        s->semester_active[i] = true;
-        s->semesters_data[i].semester_number = i + 1;
-        s->semesters_data[i].num_subjects_taken = 0;
 
-        printf("--- Semester %d ---\n", i + 1);
-        for (int j = 0; j < MAX_SUBJECTS_PER_SEMESTER; j++) {
+        printf("--- Semester %d ---\n", i);
+        int subjects_taken = 0;
+        for (int j = 0; j < marks_limits.max_subjects_per_semester; j++) {
             printf("Add subject %d for Semester %d? (y/n, or 'q' to finish semester): ",
-                   s->semesters_data[i].num_subjects_taken + 1, i + 1);
+                   subjects_taken + 1, i);
             choice_char = get_char(NULL);
             if (choice_char == 'q' || choice_char == 'Q') break;
             if (choice_char != 'y' && choice_char != 'Y') continue;
@@ -237,7 +841,7 @@ void add_marks_for_student(Student *s) {
             string sub_name_temp = NULL;
             do {
                 if(sub_name_temp) free_string(sub_name_temp);
-                sub_name_temp = get_string_non_empty("Enter Subject Name: ");
+                sub_name_temp = get_field_input("Enter Subject Name: ", SUBJECT_RESERVED_CHARS);
                 if(strlen(sub_name_temp) > MAX_SUBJECT_NAME_LENGTH) {
                     printf("Subject name too long (max %d chars).\n", MAX_SUBJECT_NAME_LENGTH);
                     free_string(sub_name_temp); 
@@ -245,26 +849,38 @@ void add_marks_for_student(Student *s) {
                 }
             } while (sub_name_temp == NULL); 
 
-            int mark = get_int_range("Enter Mark (0-100): ", 0, 100);
+            int mark = get_int_range("Enter Mark (0-100): ", 0, MAX_MARK);
 
-            int current_sub_idx = s->semesters_data[i].num_subjects_taken;
-            s->semesters_data[i].subjects[current_sub_idx].subject_name = sub_name_temp; 
-            s->semesters_data[i].subjects[current_sub_idx].mark = mark;
-            s->semesters_data[i].num_subjects_taken++;
+            Symbol subject = symbol_intern(sub_name_temp);
+            free_string(sub_name_temp);
+            if (subject == SYMBOL_NONE) {
+                fprintf(stderr, "Memory error: could not store subject name. Subject not added.\n");
+                continue;
+            }
+            if (!mark_builder_push(&builder, mark_subject_cell(subject, mark))) {
+                out_of_memory = true;
+                break;
+            }
+            subjects_taken++;
         }
     }
+    if (out_of_memory || !mark_list_copy(builder.cells, builder.count, &record_heap, &s->marks)) {
+        fprintf(stderr, "Memory error: could not store marks. Student added without marks.\n");
+        initialize_student_marks(s);
+    }
+    free(builder.cells);
 }
 
 
 void display_all_students(void) {
-    printf("\n--- All Students (Summary) --- (%d total)\n", student_count);
-    if (student_count == 0) {
+    printf("\n--- All Students (Summary) --- (%d total)\n", student_count());
+    if (student_count() == 0) {
         printf("No students in the database.\n");
         return;
     }
     print_student_table_header(true); 
-    for (int i = 0; i < student_count; i++) {
-        print_student_row(&students[i], true);
+    for (int i = 0; i < student_store.count; i++) {
+        if (student_is_live(i)) print_student_row(i, true);
     }
     print_student_table_footer();
     printf("To view detailed marks, use the Search option.\n");
@@ -273,10 +889,10 @@ void display_all_students(void) {
 void display_student_details(const Student *s, bool show_marks_details) {
     if (!s) return;
     printf("\n--- Student Details ---\n");
-    printf("ID    : %s\n", s->id ? s->id : "N/A");
-    printf("Name  : %s\n", s->name ? s->name : "N/A");
+    printf("ID    : %s\n", s->id);
+    printf("Name  : %s\n", small_name_text(&s->name));
     printf("Age   : %d\n", s->age);
-    printf("Major : %s\n", s->major ? s->major : "N/A");
+    printf("Major : %s\n", symbol_text(s->major, "N/A"));
 
     if (show_marks_details) {
         display_marks_for_student(s);
@@ -286,20 +902,20 @@ void display_student_details(const Student *s, bool show_marks_details) {
 
 void display_marks_for_student(const Student *s) {
     printf("--- Marks ---\n");
-    bool any_marks_found = false;
-    for (int i = 0; i < MAX_SEMESTERS; i++) {
-        if (s->semester_active[i] && s->semesters_data[i].num_subjects_taken > 0) {
-            any_marks_found = true;
-            printf("Semester %d:\n", s->semesters_data[i].semester_number);
-            for (int j = 0; j < s->semesters_data[i].num_subjects_taken; j++) {
-                printf("  %-*s: %3d\n",
-                       MAX_SUBJECT_NAME_LENGTH,
-                       s->semesters_data[i].subjects[j].subject_name ? s->semesters_data[i].subjects[j].subject_name : "N/A",
-                       s->semesters_data[i].subjects[j].mark);
-            }
-        } else if (s->semester_active[i]) {
-            any_marks_found = true; 
-            printf("Semester %d: No subjects recorded.\n", s->semesters_data[i].semester_number);
+    const MarkList *marks = &s->marks;
+    bool any_marks_found = marks->count > 0;
+    for (uint32_t header = 0; header < marks->count; header = mark_list_semester_end(marks, header)) {
+        uint32_t end = mark_list_semester_end(marks, header);
+        if (end == header + 1) {
+            printf("Semester %d: No subjects recorded.\n", (int)marks->cells[header].value);
+            continue;
+        }
+        printf("Semester %d:\n", (int)marks->cells[header].value);
+        for (uint32_t j = header + 1; j < end; j++) {
+            printf("  %-*s: %3d\n",
+                   MAX_SUBJECT_NAME_LENGTH,
+                   symbol_text(marks->cells[j].value, "N/A"),
+                   (int)marks->cells[j].mark);
         }
     }
     if (!any_marks_found) {
@@ -309,21 +925,7 @@ void display_marks_for_student(const Student *s) {
 
 int find_student_by_id(const string id) {
     if (id == NULL) return -1;
-    for (int i = 0; i < student_count; i++) {
-        if (students[i].id && string_equals(students[i].id, id)) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-static int compare_students_by_id_desc(const void *a, const void *b) {
-    const Student *student_a = *(const Student **)a;
-    const Student *student_b = *(const Student **)b;
-    if (student_a->id == NULL && student_b->id == NULL) return 0;
-    if (student_a->id == NULL) return 1;
-    if (student_b->id == NULL) return -1;
-    return strcmp(student_b->id, student_a->id);
+    return id_index_lookup(id);
 }
 
 void search_by_id_prefix_and_sort(void) {
@@ -334,27 +936,22 @@ void search_by_id_prefix_and_sort(void) {
         return;
     }
 
-    Student* matched_students_ptrs[MAX_STUDENTS];
-    int match_count = 0;
-    for (int i = 0; i < student_count; i++) {
-        if (students[i].id && string_starts_with(students[i].id, prefix_query_raw)) {
-            if (match_count < MAX_STUDENTS) { 
-                 matched_students_ptrs[match_count++] = &students[i];
-            } else {
-                fprintf(stderr, "Error: Too many matches for temporary buffer.\n"); 
-                break;
-            }
-        }
+    // O(log n + k): the matches are already a sorted run; walk it backwards for descending order.
+    // The run may hold deleted records awaiting compaction, which are not counted.
+    size_t first;
+    size_t run = id_order_prefix_range(prefix_query_raw, &first);
+    size_t match_count = 0;
+    for (size_t i = first; i < first + run; i++) {
+        if (student_is_live(id_order.entries[i])) match_count++;
     }
 
     if (match_count == 0) {
         printf("No students found with ID starting with '%s'.\n", prefix_query_raw);
     } else {
-        printf("\nStudents with ID starting with '%s' (%d found, sorted descending by ID):\n", prefix_query_raw, match_count);
-        qsort(matched_students_ptrs, match_count, sizeof(Student*), compare_students_by_id_desc);
+        printf("\nStudents with ID starting with '%s' (%zu found, sorted descending by ID):\n", prefix_query_raw, match_count);
         print_student_table_header(true); 
-        for (int i = 0; i < match_count; i++) {
-            print_student_row(matched_students_ptrs[i], true);
+        for (size_t i = first + run; i-- > first; ) {
+            if (student_is_live(id_order.entries[i])) print_student_row(id_order.entries[i], true);
         }
         print_student_table_footer();
     }
@@ -370,7 +967,9 @@ void search_by_exact_id(void) {
     }
     int index = find_student_by_id(id_query);
     if (index != -1) {
-        display_student_details(&students[index], true);
+        Student row;
+        student_load(index, &row);
+        display_student_details(&row, true);
     } else {
         printf("Student with ID '%s' not found.\n", id_query);
     }
@@ -378,24 +977,26 @@ void search_by_exact_id(void) {
 }
 
 void search_by_subject_mark(void) {
-    if (student_count == 0) { printf("No students to search.\n"); return; }
-    int sem_num = get_int_range("Enter Semester Number (1-4): ", 1, MAX_SEMESTERS);
+    if (student_count() == 0) { printf("No students to search.\n"); return; }
+    char prompt[64];
+    snprintf(prompt, sizeof(prompt), "Enter Semester Number (1-%d): ", marks_limits.max_semesters);
+    int sem_num = get_int_range(prompt, 1, marks_limits.max_semesters);
     string subject_query = get_string_non_empty("Enter Subject Name to search: ");
     int min_mark = get_int_range("Enter minimum mark for this subject (0-100): ", 0, 100);
 
-    printf("\nStudents with >= %d in '%s' (Semester %d):\n", min_mark, subject_query, sem_num);
+    printf("\nStudents with >= %d in '%s' (Semester %d, highest mark first):\n", min_mark, subject_query, sem_num);
     print_student_table_header(false); 
     bool found = false;
-    for(int i = 0; i < student_count; ++i) {
-        if (students[i].semester_active[sem_num - 1]) {
-            SemesterMarks *sm = &students[i].semesters_data[sem_num - 1];
-            for (int j = 0; j < sm->num_subjects_taken; ++j) {
-                if (sm->subjects[j].subject_name && string_equals(sm->subjects[j].subject_name, subject_query) && sm->subjects[j].mark >= min_mark) {
-                    print_student_row(&students[i], false);
-                    found = true;
-                    break; 
-                }
-            }
+    Symbol subject = symbol_lookup(subject_query);
+    PostingList *list = subject == SYMBOL_NONE ? NULL : mark_index_find(sem_num, subject);
+    if (list) {
+        // Binary search for the first posting with mark >= min_mark, then walk the tail backwards.
+        size_t lo = mark_index_first_at_least(list, min_mark);
+        for (size_t i = list->size; i-- > lo; ) {
+            int record = list->postings[i].record;
+            if (!student_is_live(record)) continue; // Left by a delete until the next compaction.
+            print_student_row(record, false);
+            found = true;
         }
     }
     if (!found) {
@@ -405,9 +1006,37 @@ void search_by_subject_mark(void) {
     free_string(subject_query);
 }
 
+void search_by_filter(void) {
+    printf("Fields: id, name, age, major, S<semester>.<subject> (quote subjects with spaces: S1.\"Calculus I\").\n");
+    printf("Compare with == != < <= > >= and combine with and, or, not and parentheses.\n");
+    printf("Example: major == \"Computer Science\" and age < 22 and S2.Math >= 75\n");
+    string expression = get_string_non_empty("Enter filter: ");
+    Query query;
+    char error[128];
+    if (!query_compile(expression, &query, error, sizeof(error))) {
+        printf("Invalid filter: %s\n", error);
+        free_string(expression);
+        return;
+    }
+    int *matches;
+    size_t match_count;
+    if (!query_run(&query, &matches, &match_count)) {
+        fprintf(stderr, "Memory error: could not run the filter.\n");
+    } else if (match_count == 0) {
+        printf("No students match the filter.\n");
+    } else {
+        printf("\nStudents matching the filter (%zu found, sorted ascending by ID):\n", match_count);
+        print_student_table_header(true);
+        for (size_t i = 0; i < match_count; i++) print_student_row(matches[i], true);
+        print_student_table_footer();
+    }
+    free(matches);
+    query_free(&query);
+    free_string(expression);
+}
 
 void search_student_menu(void) {
-    if (student_count == 0) {
+    if (student_count() == 0) {
         printf("No students in the database to search.\n");
         return;
     }
@@ -415,52 +1044,71 @@ void search_student_menu(void) {
     printf("1. Search by ID Prefix (sorted descending, summary)\n");
     printf("2. Search by Exact ID (view full details with marks)\n");
     printf("3. Search by Mark in a Subject\n");
+    printf("4. Search by Filter Expression\n");
     printf("0. Back to Main Menu\n");
 
-    int search_choice = get_int_range("Enter search type: ", 0, 3);
+    int search_choice = get_int_range("Enter search type: ", 0, 4);
 
     switch (search_choice) {
         case 1: search_by_id_prefix_and_sort(); break;
         case 2: search_by_exact_id(); break;
         case 3: search_by_subject_mark(); break;
+        case 4: search_by_filter(); break;
         case 0: return;
         default: printf("Invalid search choice.\n"); break;
     }
 }
 
-void update_marks_for_student(Student *s) {
-    printf("\n--- Update Marks for %s (ID: %s) ---\n", s->name, s->id);
+// Edits a row copy of the record and writes it back under store_lock. A list that
+// grows is copied into a new allocation, so the old one is freed only after the swap.
+void update_marks_for_student(int record) {
+    Student row;
+    Student *s = &row;
+    student_load(record, s);
+    printf("\n--- Update Marks for %s (ID: %s) ---\n", small_name_text(&s->name), s->id);
     display_marks_for_student(s);
 
-    int sem_choice = get_int_range("Enter Semester number to update (1-4, or 0 to cancel): ", 0, MAX_SEMESTERS);
+    char prompt[80];
+    snprintf(prompt, sizeof(prompt), "Enter Semester number to update (1-%d, or 0 to cancel): ", marks_limits.max_semesters);
+    int sem_choice = get_int_range(prompt, 0, marks_limits.max_semesters);
     if (sem_choice == 0) {
         printf("Mark update cancelled.\n");
         return;
     }
-    int sem_idx = sem_choice - 1;
 
-    if (!s->semester_active[sem_idx]) {
+    uint32_t begin, end;
+    if (!mark_list_find_semester(&s->marks, sem_choice, &begin, &end)) {
         printf("Semester %d was not previously active. Do you want to add marks now? (y/n): ", sem_choice);
         char activate_choice = get_char(NULL);
         if (activate_choice == 'y' || activate_choice == 'Y') {
-            s->semester_active[sem_idx] = true;
-            s->semesters_data[sem_idx].semester_number = sem_choice; 
-            s->semesters_data[sem_idx].num_subjects_taken = 0; 
+            MarkCell header = mark_header_cell(sem_choice);
+            MarkList updated;
+            if (!mark_list_insert(&s->marks, begin, &header, 1, &updated)) {
+                fprintf(stderr, "Memory error: could not activate Semester %d.\n", sem_choice);
+                return;
+            }
+            pthread_mutex_lock(&store_lock);
+            MarkList old = s->marks;
+            s->marks = updated;
+            student_store_at(record, s);
+            mark_list_release(&old);
+            pthread_mutex_unlock(&store_lock);
+            begin = end = begin + 1;
         } else {
             printf("Mark update for Semester %d cancelled.\n", sem_choice);
             return;
         }
     }
 
-    SemesterMarks *current_sem = &s->semesters_data[sem_idx];
+    MarkCell *cells = s->marks.cells;
     printf("--- Updating Semester %d ---\n", sem_choice);
 
-    if (current_sem->num_subjects_taken > 0) {
+    if (end > begin) {
         printf("Current subjects in Semester %d:\n", sem_choice);
-        for (int i = 0; i < current_sem->num_subjects_taken; i++) {
-            printf("%d. %s (Mark: %d)\n", i + 1, 
-                   current_sem->subjects[i].subject_name ? current_sem->subjects[i].subject_name : "N/A", 
-                   current_sem->subjects[i].mark);
+        for (uint32_t i = begin; i < end; i++) {
+            printf("%u. %s (Mark: %d)\n", i - begin + 1, 
+                   symbol_text(cells[i].value, "N/A"), 
+                   (int)cells[i].mark);
         }
     } else {
         printf("No subjects currently recorded for Semester %d.\n", sem_choice);
@@ -470,39 +1118,66 @@ void update_marks_for_student(Student *s) {
     int action = get_int_range("Choose action: ", 0, 2);
 
     if (action == 1) { 
-        if (current_sem->num_subjects_taken >= MAX_SUBJECTS_PER_SEMESTER) {
-            printf("Cannot add more subjects to Semester %d (limit: %d).\n", sem_choice, MAX_SUBJECTS_PER_SEMESTER);
+        if (end - begin >= (uint32_t)marks_limits.max_subjects_per_semester) {
+            printf("Cannot add more subjects to Semester %d (limit: %d).\n", sem_choice, marks_limits.max_subjects_per_semester);
         } else {
             string sub_name_temp = NULL;
              do {
                 if(sub_name_temp) free_string(sub_name_temp);
-                sub_name_temp = get_string_non_empty("Enter New Subject Name: ");
+                sub_name_temp = get_field_input("Enter New Subject Name: ", SUBJECT_RESERVED_CHARS);
                  if(strlen(sub_name_temp) > MAX_SUBJECT_NAME_LENGTH) {
                     printf("Subject name too long.\n"); free_string(sub_name_temp); sub_name_temp = NULL;
                 }
             } while(sub_name_temp == NULL);
 
-            int mark = get_int_range("Enter Mark (0-100): ", 0, 100);
-            current_sem->subjects[current_sem->num_subjects_taken].subject_name = sub_name_temp;
-            current_sem->subjects[current_sem->num_subjects_taken].mark = mark;
-            current_sem->num_subjects_taken++;
+            int mark = get_int_range("Enter Mark (0-100): ", 0, MAX_MARK);
+            Symbol subject = symbol_intern(sub_name_temp);
+            MarkCell cell = mark_subject_cell(subject, mark);
+            MarkList updated;
+            if (subject == SYMBOL_NONE || !mark_list_insert(&s->marks, end, &cell, 1, &updated)) {
+                fprintf(stderr, "Memory error: could not store new subject. Subject not added.\n");
+                free_string(sub_name_temp);
+                return;
+            }
+            pthread_mutex_lock(&store_lock);
+            if (!mark_index_add(sem_choice, subject, mark, record)) {
+                mark_list_release(&updated);
+                pthread_mutex_unlock(&store_lock);
+                fprintf(stderr, "Memory error: could not index new subject. Subject not added.\n");
+                free_string(sub_name_temp);
+                return;
+            }
+            MarkList old = s->marks;
+            s->marks = updated;
+            student_store_at(record, s);
+            mark_list_release(&old);
+            pthread_mutex_unlock(&store_lock);
             printf("Subject '%s' added to Semester %d.\n", sub_name_temp, sem_choice);
+            free_string(sub_name_temp);
         }
     } else if (action == 2) { 
-        if (current_sem->num_subjects_taken == 0) {
+        if (end == begin) {
             printf("No subjects to update in Semester %d.\n", sem_choice);
         } else {
             string sub_to_update = get_string_non_empty("Enter name of subject to update mark for: ");
-            int sub_found_idx = -1;
-            for (int i = 0; i < current_sem->num_subjects_taken; i++) {
-                if (current_sem->subjects[i].subject_name && string_equals(current_sem->subjects[i].subject_name, sub_to_update)) {
+            Symbol subject = symbol_lookup(sub_to_update);
+            uint32_t sub_found_idx = end;
+            for (uint32_t i = begin; subject != SYMBOL_NONE && i < end; i++) {
+                if (cells[i].value == subject) {
                     sub_found_idx = i;
                     break;
                 }
             }
-            if (sub_found_idx != -1) {
-                int new_mark = get_int_range("Enter new Mark (0-100): ", 0, 100);
-                current_sem->subjects[sub_found_idx].mark = new_mark;
+            if (sub_found_idx != end) {
+                int new_mark = get_int_range("Enter new Mark (0-100): ", 0, MAX_MARK);
+                pthread_mutex_lock(&store_lock);
+                mark_index_remove(sem_choice, subject, cells[sub_found_idx].mark, record);
+                if (!mark_index_add(sem_choice, subject, new_mark, record)) {
+                    fprintf(stderr, "Memory error: mark index for '%s' may be incomplete.\n", sub_to_update);
+                }
+                // The row shares its cells with the stored record, so this updates it in place.
+                cells[sub_found_idx].mark = (uint32_t)new_mark;
+                pthread_mutex_unlock(&store_lock);
                 printf("Mark for '%s' in Semester %d updated to %d.\n", sub_to_update, sem_choice, new_mark);
             } else {
                 printf("Subject '%s' not found in Semester %d.\n", sub_to_update, sem_choice);
@@ -515,7 +1190,7 @@ void update_marks_for_student(Student *s) {
 
 
 void update_student(void) {
-    if (student_count == 0) {
+    if (student_count() == 0) {
         printf("No students in the database to update.\n");
         return;
     }
@@ -538,36 +1213,67 @@ void update_student(void) {
     free_string(id_to_update); 
 
 
-    Student *s_to_update = &students[index];
-    printf("Student found: %s (ID: %s)\n", s_to_update->name, s_to_update->id);
+    Student row;
+    Student *s_to_update = &row;
+    student_load(index, s_to_update);
+    printf("Student found: %s (ID: %s)\n", small_name_text(&s_to_update->name), s_to_update->id);
     printf("What do you want to update?\n");
-    printf("1. Name (current: %s)\n", s_to_update->name ? s_to_update->name : "N/A");
+    printf("1. Name (current: %s)\n", small_name_text(&s_to_update->name));
     printf("2. Age (current: %d)\n", s_to_update->age);
-    printf("3. Major (current: %s)\n", s_to_update->major ? s_to_update->major : "N/A");
+    printf("3. Major (current: %s)\n", symbol_text(s_to_update->major, "N/A"));
     printf("4. Marks\n");
     printf("0. Cancel\n");
 
     int field_choice = get_int_range("Enter field to update: ", 0, 4);
     switch (field_choice) {
         case 1: {
-            string new_name = get_string_non_empty("Enter new Name: ");
-            free_string(s_to_update->name); s_to_update->name = new_name; break;
+            string name_input = get_field_input("Enter new Name: ", FIELD_RESERVED_CHARS);
+            SmallName new_name;
+            bool name_ok = small_name_set(&new_name, name_input, strlen(name_input), &record_heap);
+            free_string(name_input);
+            if (!name_ok) {
+                fprintf(stderr, "Memory error copying name. Update cancelled.\n");
+                return;
+            }
+            pthread_mutex_lock(&store_lock);
+            small_name_release(&s_to_update->name); s_to_update->name = new_name;
+            student_store_at(index, s_to_update);
+            pthread_mutex_unlock(&store_lock);
+            break;
+        }
+        case 2: {
+            int new_age = get_int_range("Enter new Age: ", 5, 100);
+            pthread_mutex_lock(&store_lock);
+            s_to_update->age = (uint8_t)new_age;
+            student_store_at(index, s_to_update);
+            pthread_mutex_unlock(&store_lock);
+            break;
         }
-        case 2: s_to_update->age = get_int_range("Enter new Age: ", 5, 100); break;
         case 3: {
-            string new_major = get_string_non_empty("Enter new Major: ");
-            free_string(s_to_update->major); s_to_update->major = new_major; break;
+            string new_major = get_field_input("Enter new Major: ", FIELD_RESERVED_CHARS);
+            Symbol major = symbol_intern(new_major);
+            free_string(new_major);
+            if (major == SYMBOL_NONE) {
+                fprintf(stderr, "Memory error: could not store major. Update cancelled.\n");
+                return;
+            }
+            pthread_mutex_lock(&store_lock);
+            s_to_update->major = major;
+            student_store_at(index, s_to_update);
+            pthread_mutex_unlock(&store_lock);
+            break;
         }
-        case 4: update_marks_for_student(s_to_update); break;
+        case 4: update_marks_for_student(index); break;
         case 0: printf("Update cancelled.\n"); return;
     }
+    wal_log_upsert(index);
     if (field_choice != 0 && field_choice != 4) { 
         printf("Student information updated successfully!\n");
     }
 }
 
 void delete_student(void) {
-    if (student_count == 0) {
+    if (student_count() == 0) {
         printf("No students in the database to delete.\n");
         return;
     }
@@ -583,25 +1289,13 @@ void delete_student(void) {
     if (index == -1) {
         printf("Student with ID '%s' not found.\n", id_to_delete);
     } else {
-        printf("Are you sure you want to delete student: %s (ID: %s)? ", students[index].name, students[index].id);
+        printf("Are you sure you want to delete student: %s (ID: %s)? ", student_name(index), student_id(index));
         char confirm = get_char("(y/n): ");
         if (confirm == 'y' || confirm == 'Y') {
-            free_string(students[index].id);
-            free_string(students[index].name);
-            free_string(students[index].major);
-            free_student_marks_memory(&students[index]);
-
-            for (int i = index; i < student_count - 1; i++) {
-                students[i] = students[i + 1];
-            }
-            if (student_count > 0) { 
-                Student *last_student = &students[student_count - 1];
-                last_student->id = NULL;
-                last_student->name = NULL;
-                last_student->major = NULL;
-                initialize_student_marks(last_student); 
-            }
-            student_count--;
+            pthread_mutex_lock(&store_lock);
+            wal_log_delete(student_id(index));
+            store_remove_at(index);
+            pthread_mutex_unlock(&store_lock);
             printf("Student deleted successfully.\n");
         } else {
             printf("Deletion cancelled.\n");
@@ -610,332 +1304,3960 @@ void delete_student(void) {
     free_string(id_to_delete);
 }
 
+static void print_merge_conflict(void *context, const char *id, const char *reason) {
+    (void)context;
+    printf("Conflict: student %s: %s. Skipped.\n", id, reason);
+}
 
-string format_marks_to_string(const Student *s) {
-    string final_str = string_copy(""); 
-    if (!final_str) return NULL;       
-
-    char temp_buffer[256]; 
-
-    for (int i = 0; i < MAX_SEMESTERS; i++) {
-        if (s->semester_active[i] && s->semesters_data[i].num_subjects_taken > 0) {
-            snprintf(temp_buffer, sizeof(temp_buffer), "S%d:", s->semesters_data[i].semester_number);
-            string semester_header_str = string_copy(temp_buffer);
-            if (!semester_header_str) {
-                free_string(final_str); return NULL;
-            }
-
-            string subjects_combined_str = string_copy("");
-            if (!subjects_combined_str) {
-                free_string(final_str); free_string(semester_header_str); return NULL;
-            }
+void merge_students_menu(void) {
+    printf("\n--- Merge CSV File ---\n");
+    printf("Rows in the %s format are added or replace the stored student.\n", DATABASE_FILE);
+    printf("A file with the header ID,MarksData updates marks of existing students.\n");
+    string path = get_string_non_empty("Enter file to merge: ");
+    MergeReport report;
+    pthread_mutex_lock(&store_lock);
+    bool merged = merge_students_from_file(path, &report, print_merge_conflict, NULL);
+    pthread_mutex_unlock(&store_lock);
+    if (!merged) {
+        printf("Could not merge %s.\n", path);
+    } else {
+        printf("Merged %s: %zu inserted, %zu updated, %zu unchanged, %zu duplicate row(s), "
+               "%zu conflict(s), %zu invalid row(s).\n", path, report.inserted, report.updated,
+               report.unchanged, report.duplicates, report.conflicts, report.rejected);
+    }
+    free_string(path);
+}
 
-            for (int j = 0; j < s->semesters_data[i].num_subjects_taken; j++) {
-                snprintf(temp_buffer, sizeof(temp_buffer), "%s=%d",
-                         s->semesters_data[i].subjects[j].subject_name ? s->semesters_data[i].subjects[j].subject_name : "N/A",
-                         s->semesters_data[i].subjects[j].mark);
-                string subject_entry_str = string_copy(temp_buffer);
-                if (!subject_entry_str) {
-                    free_string(final_str); free_string(semester_header_str);
-                    free_string(subjects_combined_str); return NULL;
-                }
 
-                string old_subjects_combined_str = subjects_combined_str;
-                if (j > 0) { 
-                    subjects_combined_str = string_concat(subjects_combined_str, ",");
-                    if (!subjects_combined_str) {
-                        free_string(final_str); free_string(semester_header_str);
-                        free_string(old_subjects_combined_str); free_string(subject_entry_str);
-                        return NULL;
-                    }
-                    free_string(old_subjects_combined_str); 
-                    old_subjects_combined_str = subjects_combined_str; 
-                }
+// Appends the MarksData column ("S1:Math=90,Physics=80;S2:...") to `out` in one
+// pass, with no intermediate strings. Returns false only if `out` cannot grow.
+bool format_marks_into(int index, string_buffer *out) {
+    const MarkList *marks = student_marks(index);
+    bool first_semester = true;
+    for (uint32_t header = 0; header < marks->count; header = mark_list_semester_end(marks, header)) {
+        uint32_t end = mark_list_semester_end(marks, header);
+        if (end == header + 1) continue;
+        if (!first_semester && !string_buffer_append_char(out, ';')) return false;
+        first_semester = false;
+        if (!string_buffer_append_char(out, 'S') ||
+            !string_buffer_append_int(out, (int)marks->cells[header].value) ||
+            !string_buffer_append_char(out, ':')) return false;
+        for (uint32_t j = header + 1; j < end; j++) {
+            const MarkCell *cell = &marks->cells[j];
+            if (j > header + 1 && !string_buffer_append_char(out, ',')) return false;
+            if (!string_buffer_append(out, symbol_text(cell->value, "N/A")) ||
+                !string_buffer_append_char(out, '=') ||
+                !string_buffer_append_int(out, (int)cell->mark)) return false;
+        }
+    }
+    return true;
+}
 
-                subjects_combined_str = string_concat(subjects_combined_str, subject_entry_str);
-                if (!subjects_combined_str) {
-                    free_string(final_str); free_string(semester_header_str);
-                    free_string(old_subjects_combined_str); free_string(subject_entry_str);
-                    return NULL;
-                }
-                free_string(old_subjects_combined_str); 
-                free_string(subject_entry_str);         
-            }
+// Semester numbers and marks in MarksData have always been read as decimals and
+// truncated, so "90.5" is 90 and "1e1" is 10. Plain digits skip strtod.
+static int marks_data_number(const char *text, size_t length, bool *ok) {
+    int value = string_n_to_int(text, length, ok);
+    if (*ok) return value;
+    double parsed = string_n_to_double(text, length, ok);
+    if (*ok && !(parsed > (double)INT_MIN - 1.0 && parsed < (double)INT_MAX + 1.0)) *ok = false;
+    return *ok ? (int)parsed : 0;
+}
 
-            string old_final_str = final_str;
-            if (strlen(old_final_str) > 0) { 
-                final_str = string_concat(final_str, ";");
-                if (!final_str) {
-                    free_string(semester_header_str); free_string(subjects_combined_str);
-                    free_string(old_final_str); return NULL;
+// Parses the subject list of one semester ("Math=90,Physics=80"), appending a cell
+// per subject to `cells`, which has room for every '=' in the text.
+static void parse_semester_subjects(MarkCell *cells, uint32_t *count, int sem_num, const char *text, const char *end) {
+    const char *token = text;
+    int subjects_taken = 0;
+    for (;;) {
+        const char *token_end = memchr(token, ',', (size_t)(end - token));
+        if (token_end == NULL) token_end = end;
+        if (subjects_taken >= MARKS_LIMIT_CEILING) {
+            fprintf(stderr, "Warning: Too many subjects for semester %d in record. Some ignored.\n", sem_num);
+            return;
+        }
+        int token_length = (int)(token_end - token);
+        const char *equals = memchr(token, '=', (size_t)token_length);
+        if (token_length == 0) {
+            // Empty subject entry: nothing to record.
+        } else if (equals == NULL || memchr(equals + 1, '=', (size_t)(token_end - equals - 1)) != NULL) {
+            fprintf(stderr, "Warning: Malformed subject-mark pair: %.*s\n", token_length, token);
+        } else {
+            int name_length = (int)(equals - token);
+            int mark_length = (int)(token_end - equals - 1);
+            bool mark_ok;
+            int mark_val = marks_data_number(equals + 1, (size_t)mark_length, &mark_ok);
+            if (name_length == 0 || name_length > MAX_SUBJECT_NAME_LENGTH) {
+                fprintf(stderr, "Warning: Invalid/long/empty subject name: %.*s\n", name_length, token);
+            } else if (!mark_ok || mark_val < 0 || mark_val > MAX_MARK) {
+                fprintf(stderr, "Warning: Invalid mark for subject %.*s: %.*s\n", name_length, token, mark_length, equals + 1);
+            } else {
+                Symbol subject = symbol_intern_n(token, (size_t)name_length);
+                if (subject == SYMBOL_NONE) {
+                    fprintf(stderr, "Warning: Invalid/long/empty subject name: %.*s\n", name_length, token);
+                } else {
+                    cells[(*count)++] = mark_subject_cell(subject, mark_val);
+                    subjects_taken++;
                 }
-                free_string(old_final_str);
-                old_final_str = final_str;
-            }
-
-            final_str = string_concat(final_str, semester_header_str);
-            if (!final_str) {
-                free_string(semester_header_str); free_string(subjects_combined_str);
-                free_string(old_final_str); return NULL;
-            }
-            free_string(old_final_str);
-            old_final_str = final_str;
-
-            final_str = string_concat(final_str, subjects_combined_str);
-            if (!final_str) {
-                free_string(semester_header_str); free_string(subjects_combined_str);
-                free_string(old_final_str); return NULL;
             }
-            free_string(old_final_str);
-
-            free_string(semester_header_str);
-            free_string(subjects_combined_str);
         }
+        if (token_end == end) return;
+        token = token_end + 1;
     }
-    return final_str;
 }
 
+static int compare_mark_blocks(const void *a, const void *b) {
+    const MarkBlock *ba = a, *bb = b;
+    if (ba->semester != bb->semester) return ba->semester < bb->semester ? -1 : 1;
+    return ba->start < bb->start ? -1 : (ba->start > bb->start);
+}
 
-bool parse_marks_from_string(Student *s, const string marks_str) {
-    if (string_is_empty(marks_str)) return true; 
-
-    initialize_student_marks(s); 
+// Puts parsed semester blocks in ascending order. When a semester appears more
+// than once the last block wins, as it always has for MarksData. Returns false if
+// out of memory.
+static bool mark_cells_normalize(MarkCell *cells, uint32_t *count) {
+    MarkList parsed = { cells, *count };
+    uint32_t block_count = 0;
+    for (uint32_t h = 0; h < parsed.count; h = mark_list_semester_end(&parsed, h)) block_count++;
+    MarkBlock *blocks = malloc(block_count * sizeof(MarkBlock));
+    MarkCell *sorted = malloc(parsed.count * sizeof(MarkCell));
+    if (blocks == NULL || sorted == NULL) {
+        free(blocks);
+        free(sorted);
+        return false;
+    }
+    uint32_t b = 0;
+    for (uint32_t h = 0; h < parsed.count; h = mark_list_semester_end(&parsed, h)) {
+        blocks[b++] = (MarkBlock){ cells[h].value, h, mark_list_semester_end(&parsed, h) - h };
+    }
+    qsort(blocks, block_count, sizeof(MarkBlock), compare_mark_blocks);
+    uint32_t kept = 0;
+    for (b = 0; b < block_count; b++) {
+        if (b + 1 < block_count && blocks[b + 1].semester == blocks[b].semester) continue;
+        memcpy(sorted + kept, cells + blocks[b].start, blocks[b].length * sizeof(MarkCell));
+        kept += blocks[b].length;
+    }
+    memcpy(cells, sorted, kept * sizeof(MarkCell));
+    *count = kept;
+    free(blocks);
+    free(sorted);
+    return true;
+}
 
-    size_t num_sem_tokens;
-    string *sem_tokens = string_split(marks_str, ';', &num_sem_tokens);
-    if (!sem_tokens) return false; 
+// Single-pass scanner over a MarksData field of `length` bytes
+// ("S1:Math=90,Physics=80;S2:...") into `list`, allocated from `heap`. Subject
+// names are interned straight from the input. Malformed pieces are reported and
+// skipped. Only MARKS_LIMIT_CEILING bounds the counts, since log replay and CSV
+// import must read back whatever was saved; callers taking new input check
+// marks_limits themselves.
+bool parse_marks_from_string(MarkList *list, const char *marks, size_t length, arena *heap) {
+    list->cells = NULL;
+    list->count = 0;
+    if (length == 0) return true; 
 
-    for (size_t i = 0; i < num_sem_tokens; i++) {
-        if (string_is_empty(sem_tokens[i])) continue;
+    // Every semester header needs a ':' and every subject a '=', so this bounds the cells.
+    uint32_t capacity = 0;
+    for (size_t i = 0; i < length; i++) capacity += marks[i] == ':' || marks[i] == '=';
+    MarkCell *cells = NULL;
+    if (capacity > 0 && (cells = arena_alloc(heap, capacity * sizeof(MarkCell))) == NULL) return false;
+    uint32_t count = 0;
+    int highest_semester = 0;
+    bool ascending = true;
 
-        size_t num_header_parts;
-        string *header_parts = string_split(sem_tokens[i], ':', &num_header_parts);
-        if (!header_parts || num_header_parts != 2) {
-            fprintf(stderr, "Warning: Malformed semester block in marks data: %s\n", sem_tokens[i]);
-            if(header_parts) free_string_array(header_parts, num_header_parts);
-            continue;
-        }
+    const char *end = marks + length;
+    const char *block = marks;
+    for (;;) {
+        const char *block_end = memchr(block, ';', (size_t)(end - block));
+        if (block_end == NULL) block_end = end;
+        int block_length = (int)(block_end - block);
+        const char *colon = memchr(block, ':', (size_t)block_length);
 
-        if (strlen(header_parts[0]) < 2 || header_parts[0][0] != 'S') {
-             fprintf(stderr, "Warning: Malformed semester identifier in marks data: %s\n", header_parts[0]);
-             free_string_array(header_parts, num_header_parts);
-             continue;
-        }
-        bool sem_num_ok;
-        
-        string sem_num_str = string_substring(header_parts[0], 1, strlen(header_parts[0]) - 1);
-        if (!sem_num_str) {
-            fprintf(stderr, "Memory error parsing semester number string.\n");
-            free_string_array(header_parts, num_header_parts);
-            continue;
+        if (block_length == 0) {
+            // Empty semester block: nothing to record.
+        } else if (colon == NULL || memchr(colon + 1, ':', (size_t)(block_end - colon - 1)) != NULL) {
+            fprintf(stderr, "Warning: Malformed semester block in marks data: %.*s\n", block_length, block);
+        } else {
+            int header_length = (int)(colon - block);
+            bool sem_num_ok = false;
+            int sem_num = 0;
+            if (header_length < 2 || block[0] != 'S') {
+                fprintf(stderr, "Warning: Malformed semester identifier in marks data: %.*s\n", header_length, block);
+            } else {
+                sem_num = marks_data_number(block + 1, (size_t)header_length - 1, &sem_num_ok);
+                if (!sem_num_ok || sem_num < 1 || sem_num > MARKS_LIMIT_CEILING) {
+                    fprintf(stderr, "Warning: Invalid semester number in marks data: %.*s\n", header_length, block);
+                    sem_num_ok = false;
+                }
+            }
+            if (sem_num_ok) {
+                if (sem_num <= highest_semester) ascending = false;
+                else highest_semester = sem_num;
+                cells[count++] = mark_header_cell(sem_num);
+                if (colon + 1 < block_end) parse_semester_subjects(cells, &count, sem_num, colon + 1, block_end);
+            }
         }
-        int sem_num = (int)string_to_double(sem_num_str, &sem_num_ok);
-        free_string(sem_num_str);
+        if (block_end == end) break;
+        block = block_end + 1;
+    }
 
-        if (!sem_num_ok || sem_num < 1 || sem_num > MAX_SEMESTERS) {
-            fprintf(stderr, "Warning: Invalid semester number in marks data: %s\n", header_parts[0]);
-            free_string_array(header_parts, num_header_parts);
-            continue;
-        }
-        int sem_idx = sem_num - 1;
-        s->semester_active[sem_idx] = true;
-        s->semesters_data[sem_idx].semester_number = sem_num;
-        s->semesters_data[sem_idx].num_subjects_taken = 0;
+    bool ok = ascending || mark_cells_normalize(cells, &count);
+    if (ok && count == capacity) {
+        list->cells = cells;
+        list->count = count;
+        return true;
+    }
+    // Some pieces were skipped: keep only the cells that were filled in.
+    ok = ok && mark_list_copy(cells, count, heap, list);
+    arena_free(heap, cells, capacity * sizeof(MarkCell));
+    return ok;
+}
 
 
-        if (string_is_empty(header_parts[1])) { 
-            free_string_array(header_parts, num_header_parts);
-            continue;
-        }
+// True for 1 to MAX_ID_LENGTH digits: the only IDs the store accepts from any source.
+static bool student_id_valid(const char *text, size_t length) {
+    if (length == 0 || length > MAX_ID_LENGTH) return false;
+    for (size_t i = 0; i < length; i++) {
+        if (!isdigit((unsigned char)text[i])) return false;
+    }
+    return true;
+}
 
-        size_t num_subject_tokens;
-        string *subject_tokens = string_split(header_parts[1], ',', &num_subject_tokens);
-        if (!subject_tokens) {
-            free_string_array(header_parts, num_header_parts); 
-            continue;
-        }
+// Parses one "ID,Name,Age,Major,MarksData" row of `length` bytes into `s`. The row
+// is tokenized in place as pointer/length views; only the mark list and a name
+// too long to store inline are allocated, from `heap`, and the major and
+// subjects are interned.
+// MarksData uses commas between subjects, so everything after the fourth comma
+// belongs to it. Prints a warning naming `source` and returns false
+// if the row must be skipped.
+bool parse_student_line(const char *line, size_t length, Student *s, const char *source, arena *heap) {
+    initialize_student_marks(s); 
+    s->id[0] = '\0'; s->name = (SmallName){ { 0 } }; s->age = 0; s->major = SYMBOL_NONE;
 
-        for (size_t j = 0; j < num_subject_tokens; j++) {
-            if (s->semesters_data[sem_idx].num_subjects_taken >= MAX_SUBJECTS_PER_SEMESTER) {
-                fprintf(stderr, "Warning: Too many subjects for semester %d in record. Some ignored.\n", sem_num);
-                break; 
-            }
-            if (string_is_empty(subject_tokens[j])) continue;
+    const char *field_start[5];
+    size_t field_length[5];
+    const char *cursor = line, *end = line + length;
+    size_t num_fields = 0;
+    while (num_fields < 4) {
+        const char *comma = memchr(cursor, ',', (size_t)(end - cursor));
+        if (comma == NULL) break;
+        field_start[num_fields] = cursor;
+        field_length[num_fields++] = (size_t)(comma - cursor);
+        cursor = comma + 1;
+    }
+    field_start[num_fields] = cursor;
+    field_length[num_fields++] = (size_t)(end - cursor);
+    if (num_fields < 5) {
+        fprintf(stderr, "Warning: Malformed line in %s (expected 5 fields, got %zu): %.*s. Skipping.\n",
+                source, num_fields, (int)length, line);
+        return false;
+    }
 
-            size_t num_mark_parts;
-            string *mark_parts = string_split(subject_tokens[j], '=', &num_mark_parts);
-            if (!mark_parts || num_mark_parts != 2) {
-                fprintf(stderr, "Warning: Malformed subject-mark pair: %s\n", subject_tokens[j]);
-                if(mark_parts) free_string_array(mark_parts, num_mark_parts);
-                continue;
-            }
+    if (!student_id_valid(field_start[0], field_length[0])) {
+        fprintf(stderr, "Warning: Invalid ID format/length in line: %.*s. Skipping.\n", (int)length, line);
+        return false;
+    }
 
-            string sub_name = string_copy(mark_parts[0]);
-            if (!sub_name || strlen(sub_name) > MAX_SUBJECT_NAME_LENGTH || string_is_empty(sub_name)) {
-                 fprintf(stderr, "Warning: Invalid/long/empty subject name: %s\n", mark_parts[0]);
-                 free_string(sub_name); free_string_array(mark_parts, num_mark_parts); continue;
-            }
+    bool success_age_parse;
+    int age = string_n_to_int(field_start[2], field_length[2], &success_age_parse);
+    if (!success_age_parse || age <= 0 || age > MAX_AGE) {
+        fprintf(stderr, "Warning: Invalid Age format/value in line: %.*s. Skipping.\n", (int)length, line);
+        return false;
+    }
 
-            bool mark_ok;
-            int mark_val = (int)string_to_double(mark_parts[1], &mark_ok);
-            if (!mark_ok || mark_val < 0 || mark_val > 100) {
-                fprintf(stderr, "Warning: Invalid mark for subject %s: %s\n", sub_name, mark_parts[1]);
-                free_string(sub_name); free_string_array(mark_parts, num_mark_parts); continue;
-            }
+    memcpy(s->id, field_start[0], field_length[0]);
+    s->id[field_length[0]] = '\0';
+    s->age = (uint8_t)age;
+    s->major = symbol_intern_n(field_start[3], field_length[3]);
+    if (s->major == SYMBOL_NONE || !small_name_set(&s->name, field_start[1], field_length[1], heap)) {
+        fprintf(stderr, "Memory allocation failed for student fields: %.*s. Skipping.\n", (int)length, line);
+        return false;
+    }
 
-            int current_sub_idx = s->semesters_data[sem_idx].num_subjects_taken;
-            s->semesters_data[sem_idx].subjects[current_sub_idx].subject_name = sub_name;
-            s->semesters_data[sem_idx].subjects[current_sub_idx].mark = mark_val;
-            s->semesters_data[sem_idx].num_subjects_taken++;
+    if (!parse_marks_from_string(&s->marks, field_start[4], field_length[4], heap)) {
+        fprintf(stderr, "Warning: Error parsing marks for student %s. Marks may be incomplete or missing.\n", s->id);
+    }
+    return true;
+}
 
-            free_string_array(mark_parts, num_mark_parts);
+void report_subject_statistics(void) {
+    SubjectStats *subjects;
+    size_t subject_count;
+    if (!marks_aggregate(&subjects, &subject_count, NULL, NULL)) {
+        fprintf(stderr, "Memory error: could not compute subject statistics.\n");
+        return;
+    }
+    if (subject_count == 0) {
+        printf("No marks recorded yet.\n");
+    } else {
+        printf("\nSubject statistics over all semesters (%zu subject(s)):\n", subject_count);
+        printf("-----------------------------------------------------------------------------------\n");
+        printf("| %-*s | %-8s | %-7s | %-4s | %-4s | %-7s |\n", MAX_SUBJECT_NAME_LENGTH, "Subject", "Marks", "Mean", "Min", "Max", "Std Dev");
+        printf("-----------------------------------------------------------------------------------\n");
+        for (size_t i = 0; i < subject_count; i++) {
+            const SubjectStats *stats = &subjects[i];
+            printf("| %-*s | %-8zu | %-7.2f | %-4d | %-4d | %-7.2f |\n", MAX_SUBJECT_NAME_LENGTH,
+                   symbol_text(stats->subject, "N/A"), stats->count, subject_stats_mean(stats),
+                   stats->min, stats->max, subject_stats_stddev(stats));
         }
-        free_string_array(subject_tokens, num_subject_tokens);
-        free_string_array(header_parts, num_header_parts);
+        printf("-----------------------------------------------------------------------------------\n");
     }
-    free_string_array(sem_tokens, num_sem_tokens);
-    return true;
+    free(subjects);
 }
 
+static void print_student_grades(const StudentGrades *grades) {
+    if (grades->subjects == 0) {
+        printf("No marks recorded, so no average or GPA.\n");
+        return;
+    }
+    for (size_t i = 0; i < grades->semester_count; i++) {
+        const SemesterGrades *semester = &grades->semesters[i];
+        printf("Semester %d: %d subject(s), average %.2f, GPA %.2f\n",
+               semester->semester, semester->subjects, semester->average, semester->gpa);
+    }
+    printf("Overall   : %d subject(s), average %.2f (lowest %d, highest %d), CGPA %.2f\n",
+           grades->subjects, grades->average, grades->min, grades->max, grades->cgpa);
+}
 
-bool load_students_from_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) return false;
+void report_student_card(void) {
+    string id = get_string_non_empty("Enter Student ID: ");
+    int index = string_is_digit(id) ? find_student_by_id(id) : -1;
+    if (index == -1) {
+        printf("Student with ID '%s' not found.\n", id);
+        free_string(id);
+        return;
+    }
+    Student row;
+    student_load(index, &row);
+    display_student_details(&row, true);
+    GradeBuffer buffer = { NULL, NULL, NULL, 0 };
+    StudentGrades grades;
+    if (student_grades(&row.marks, &buffer, &grades)) {
+        print_student_grades(&grades);
+    } else {
+        fprintf(stderr, "Memory error: could not compute grades.\n");
+    }
+    grade_buffer_free(&buffer);
+    free_string(id);
+}
 
-    char line_buffer[1024]; 
-    student_count = 0;
+static void print_grades_row(void *context, int record, const StudentGrades *grades) {
+    (void)context;
+    printf("| %-*s | %-25s | %-8d |", MAX_ID_LENGTH, student_id(record), student_name(record), grades->subjects);
+    if (grades->subjects == 0) printf(" %-7s | %-5s |\n", "-", "-");
+    else printf(" %-7.2f | %-5.2f |\n", grades->average, grades->cgpa);
+}
 
-    
-    if (fgets(line_buffer, sizeof(line_buffer), file) == NULL) { 
-        fclose(file); return feof(file); 
+void report_all_grades(void) {
+    printf("-----------------------------------------------------------------------------------\n");
+    printf("| %-*s | %-25s | %-8s | %-7s | %-5s |\n", MAX_ID_LENGTH, "ID", "Name", "Subjects", "Average", "CGPA");
+    printf("-----------------------------------------------------------------------------------\n");
+    SubjectStats *subjects;
+    size_t subject_count;
+    if (!marks_aggregate(&subjects, &subject_count, print_grades_row, NULL)) {
+        fprintf(stderr, "Memory error: could not compute all grades.\n");
     }
-    
+    free(subjects);
+    print_student_table_footer();
+}
 
-    while (fgets(line_buffer, sizeof(line_buffer), file) != NULL && student_count < MAX_STUDENTS) {
-        line_buffer[strcspn(line_buffer, "\r\n")] = 0; 
-        if (string_is_empty(line_buffer)) continue;
+// Shown with two decimals, except for metrics that are whole numbers.
+static bool rank_metric_is_integer(const RankMetric *metric) {
+    return metric->kind == RANK_AGE || metric->kind == RANK_MARK;
+}
+
+void report_ranking(bool highest) {
+    int k = get_int_range("How many students? ", 1, student_count());
+    printf("Metrics: age, average, cgpa, S<semester>.<subject>, S<semester>.average, S<semester>.gpa\n");
+    printf("Optionally add a filter (see Search by Filter Expression) after \"where\".\n");
+    printf("Example: S3.average where major == \"Computer Science\"\n");
+    string text = get_string_non_empty("Enter metric: ");
+    RankMetric metric;
+    Query filter;
+    char error[128];
+    if (!rank_compile(text, &metric, &filter, error, sizeof(error))) {
+        printf("Invalid metric: %s\n", error);
+        free_string(text);
+        return;
+    }
+    RankEntry *entries;
+    size_t count;
+    if (!rank_students(&metric, &filter, (size_t)k, highest, &entries, &count)) {
+        fprintf(stderr, "Memory error: could not rank students.\n");
+    } else if (count == 0) {
+        printf("No students have a value for that metric.\n");
+    } else {
+        printf("\n%s %zu student(s) by %s:\n", highest ? "Top" : "Bottom", count, text);
+        printf("-----------------------------------------------------------------------------------\n");
+        printf("| %-6s | %-*s | %-25s | %-14s |\n", "Rank", MAX_ID_LENGTH, "ID", "Name", "Value");
+        printf("-----------------------------------------------------------------------------------\n");
+        for (size_t i = 0; i < count; i++) {
+            int record = entries[i].record;
+            printf("| %-6zu | %-*s | %-25s | ", i + 1, MAX_ID_LENGTH, student_id(record), student_name(record));
+            if (rank_metric_is_integer(&metric)) printf("%-14.0f |\n", entries[i].value);
+            else printf("%-14.2f |\n", entries[i].value);
+        }
+        print_student_table_footer();
+    }
+    free(entries);
+    query_free(&filter);
+    free_string(text);
+}
+
+void reports_menu(void) {
+    if (student_count() == 0) {
+        printf("No students in the database to report on.\n");
+        return;
+    }
+    printf("\n--- Reports ---\n");
+    printf("1. Subject Statistics (mean, min, max, std dev)\n");
+    printf("2. Student Report Card (average and GPA per semester)\n");
+    printf("3. Averages and CGPA for All Students\n");
+    printf("4. Top Students by a Metric (mark, average, GPA or age)\n");
+    printf("5. Bottom Students by a Metric\n");
+    printf("0. Back to Main Menu\n");
+
+    switch (get_int_range("Enter report type: ", 0, 5)) {
+        case 1: report_subject_statistics(); break;
+        case 2: report_student_card(); break;
+        case 3: report_all_grades(); break;
+        case 4: report_ranking(true); break;
+        case 5: report_ranking(false); break;
+        default: return;
+    }
+}
+
+// Parses an "ID,MarksData" row into `s`, leaving the other fields empty. As with
+// batch "marks", malformed pieces are skipped; a row with no valid mark is rejected.
+bool parse_marks_delta_line(const char *line, size_t length, Student *s, const char *source, arena *heap) {
+    initialize_student_marks(s);
+    s->id[0] = '\0'; s->name = (SmallName){ { 0 } }; s->age = 0; s->major = SYMBOL_NONE;
+
+    const char *comma = memchr(line, ',', length);
+    size_t id_length = comma ? (size_t)(comma - line) : length;
+    if (!student_id_valid(line, id_length) || comma == NULL) {
+        fprintf(stderr, "Warning: Malformed marks row in %s: %.*s. Skipping.\n", source, (int)length, line);
+        return false;
+    }
+    memcpy(s->id, line, id_length);
+    s->id[id_length] = '\0';
+    if (!parse_marks_from_string(&s->marks, comma + 1, (size_t)(line + length - comma - 1), heap)) {
+        fprintf(stderr, "Memory allocation failed for marks of student %s. Skipping.\n", s->id);
+        return false;
+    }
+    if (mark_list_subject_count(&s->marks) == 0) {
+        fprintf(stderr, "Warning: No valid marks for student %s in %s. Skipping.\n", s->id, source);
+        if (s->marks.cells != NULL) arena_free(heap, s->marks.cells, s->marks.count * sizeof(MarkCell));
+        return false;
+    }
+    return true;
+}
+
+// Appends one CSV row for `s`, terminated by a newline, to `out`.
+bool format_student_line(int index, string_buffer *out) {
+    return string_buffer_append(out, student_id(index)) &&
+           string_buffer_append_char(out, ',') &&
+           string_buffer_append(out, student_name(index)) &&
+           string_buffer_append_char(out, ',') &&
+           string_buffer_append_int(out, student_age(index)) &&
+           string_buffer_append_char(out, ',') &&
+           string_buffer_append(out, symbol_text(student_major(index), "")) &&
+           string_buffer_append_char(out, ',') &&
+           format_marks_into(index, out) &&
+           string_buffer_append_char(out, '\n');
+}
+
+static bool import_chunk_push(ImportChunk *chunk, const Student *s, const char *line, size_t line_length) {
+    if (chunk->count == chunk->capacity) {
+        size_t new_capacity = chunk->capacity == 0 ? 1024 : chunk->capacity * 2;
+        ImportRow *temp = realloc(chunk->rows, new_capacity * sizeof(ImportRow));
+        if (!temp) return false;
+        chunk->rows = temp;
+        chunk->capacity = new_capacity;
+    }
+    ImportRow *row = &chunk->rows[chunk->count++];
+    row->student = *s;
+    row->line = line;
+    row->line_length = line_length;
+    return true;
+}
+
+// Parses every row in [begin, end) into chunk->rows, allocating strings from the
+// chunk's own arena. Shares only the symbol table, so chunks can be parsed concurrently.
+static void *import_chunk_worker(void *arg) {
+    ImportChunk *chunk = arg;
+    const char *line = chunk->begin;
+    while (line < chunk->end) {
+        const char *newline = memchr(line, '\n', (size_t)(chunk->end - line));
+        const char *next = newline ? newline + 1 : chunk->end;
+        size_t line_length = (size_t)((newline ? newline : chunk->end) - line);
+        if (line_length > 0 && line[line_length - 1] == '\r') line_length--;
+        Student s;
+        if (line_length > 0) {
+            bool parsed = chunk->marks_only
+                ? parse_marks_delta_line(line, line_length, &s, chunk->source, &chunk->heap)
+                : parse_student_line(line, line_length, &s, chunk->source, &chunk->heap);
+            if (!parsed) {
+                chunk->rejected++;
+            } else if (!import_chunk_push(chunk, &s, line, line_length)) {
+                // Its strings stay in chunk->heap, which is released with the rest.
+                chunk->out_of_memory = true;
+                break;
+            }
+        }
+        line = next;
+    }
+    return NULL;
+}
+
+static int import_thread_count(size_t length) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 0 ? (size_t)cpus : 1;
+    if (threads > IMPORT_MAX_THREADS) threads = IMPORT_MAX_THREADS;
+    size_t by_size = length / IMPORT_MIN_CHUNK_BYTES + 1;
+    return (int)(threads < by_size ? threads : by_size);
+}
+
+// Splits [body, end) into newline-aligned chunks and parses them on separate
+// threads, each filling its own arena; the arenas are then merged into
+// record_heap. Returns the number of chunks, whose rows are in file order.
+static int import_parse(const char *body, const char *end, const char *source, bool marks_only, ImportChunk *chunks) {
+    int thread_count = import_thread_count((size_t)(end - body));
+    pthread_t threads[IMPORT_MAX_THREADS];
+    const char *chunk_begin = body;
+    for (int t = 0; t < thread_count; t++) {
+        const char *chunk_end = end;
+        if (t < thread_count - 1) {
+            chunk_end = chunk_begin + (size_t)(end - chunk_begin) / (size_t)(thread_count - t);
+            const char *newline = chunk_end < end ? memchr(chunk_end, '\n', (size_t)(end - chunk_end)) : NULL;
+            chunk_end = newline ? newline + 1 : end;
+        }
+        chunks[t] = (ImportChunk){ chunk_begin, chunk_end, source, marks_only, { NULL, 0, { NULL }, NULL }, NULL, 0, 0, 0, false };
+        chunk_begin = chunk_end;
+    }
+    int started = 0;
+    for (int t = 1; t < thread_count; t++, started++) {
+        if (pthread_create(&threads[t], NULL, import_chunk_worker, &chunks[t]) != 0) break;
+    }
+    import_chunk_worker(&chunks[0]);
+    for (int t = 1; t <= started; t++) pthread_join(threads[t], NULL);
+    for (int t = started + 1; t < thread_count; t++) import_chunk_worker(&chunks[t]);
+    for (int t = 0; t < thread_count; t++) arena_merge(&record_heap, &chunks[t].heap);
+    return thread_count;
+}
+
+// Maps the CSV, splits it into newline-aligned chunks and parses them on
+// separate threads. Rows are then merged in file order on this thread, so the
+// result (and which copy of a duplicate ID wins: the first) matches a sequential
+// load. Rows have no length limit and nothing but stored strings is allocated.
+bool load_students_from_file(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return false; }
+    size_t length = (size_t)st.st_size;
+    free_all_student_memory();
+    if (length == 0) { close(fd); return true; }
+    const char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    posix_madvise((void *)data, length, POSIX_MADV_WILLNEED);
+
+    const char *end = data + length;
+    const char *body = memchr(data, '\n', length);
+    body = body ? body + 1 : end; // Skip the header row.
+
+    ImportChunk chunks[IMPORT_MAX_THREADS];
+    int thread_count = import_parse(body, end, filename, false, chunks);
+    size_t parsed_rows = 0;
+    for (int t = 0; t < thread_count; t++) parsed_rows += chunks[t].count;
+    id_order.deferred = true;
+    mark_index.deferred = true;
+    id_index_reserve(parsed_rows);
+
+    bool out_of_memory = false;
+    for (int t = 0; t < thread_count; t++) {
+        if (chunks[t].out_of_memory) out_of_memory = true;
+        for (size_t i = 0; i < chunks[t].count; i++) {
+            ImportRow *row = &chunks[t].rows[i];
+            if (out_of_memory) { free_student_record(&row->student); continue; }
+            if (find_student_by_id(row->student.id) != -1) { 
+                fprintf(stderr, "Warning: Duplicate Student ID '%s' found in file. Skipping record: %.*s\n",
+                        row->student.id, (int)row->line_length, row->line);
+                free_student_record(&row->student);
+                continue;
+            }
+            bool stored = store_append(&row->student);
+            if (!stored || !index_student(student_store.count - 1)) {
+                if (stored) student_store.count--;
+                free_student_record(&row->student);
+                out_of_memory = true;
+            }
+        }
+        free(chunks[t].rows);
+    }
+    if (out_of_memory) {
+        fprintf(stderr, "Memory error: could not load all of %s. Loaded %d student(s).\n", filename, student_store.count);
+    }
+    munmap((void *)data, length);
+    if (!mark_index_build()) fprintf(stderr, "Memory error: mark index may be incomplete.\n");
+    if (!id_order_build()) {
+        fprintf(stderr, "Memory error: could not build ordered ID index.\n");
+        return false;
+    }
+    return true;
+}
+
+// Orders rows by ID, then by position in the file, so the first copy leads its run.
+static int merge_row_compare(const void *a, const void *b) {
+    const ImportRow *x = *(ImportRow *const *)a, *y = *(ImportRow *const *)b;
+    int cmp = strcmp(x->student.id, y->student.id);
+    if (cmp != 0) return cmp;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+// True if `s` holds exactly what record `index` already stores.
+static bool student_matches(int index, const Student *s) {
+    const MarkList *marks = student_marks(index);
+    return student_age(index) == s->age && student_major(index) == s->major &&
+           strcmp(student_name(index), small_name_text(&s->name)) == 0 &&
+           marks->count == s->marks.count &&
+           (marks->count == 0 || memcmp(marks->cells, s->marks.cells, marks->count * sizeof(MarkCell)) == 0);
+}
+
+static void merge_conflict(MergeReport *report, MergeConflictFn on_conflict, void *context,
+                           const char *id, const char *reason) {
+    report->conflicts++;
+    if (on_conflict != NULL) on_conflict(context, id, reason);
+}
+
+// Applies a full row to existing record `index` (or inserts it if -1). Takes
+// ownership of row's strings. Returns false only when out of memory.
+static bool merge_apply_row(Student *row, int index, MergeReport *report) {
+    if (index == -1) {
+        bool stored = store_append(row);
+        if (!stored || !index_student(student_store.count - 1)) {
+            if (stored) student_store.count--;
+            free_student_record(row);
+            return false;
+        }
+        wal_log_upsert(student_store.count - 1);
+        report->inserted++;
+    } else if (student_matches(index, row)) {
+        free_student_record(row);
+        report->unchanged++;
+    } else {
+        student_release_at(index);
+        student_store_at(index, row);
+        wal_log_upsert(index);
+        report->updated++;
+    }
+    return true;
+}
+
+// Folds a marks-delta row into existing record `index` as batch "marks" does.
+// Returns false only when out of memory.
+static bool merge_apply_delta(Student *row, int index, MergeReport *report, MergeConflictFn on_conflict, void *context) {
+    if (index == -1) {
+        merge_conflict(report, on_conflict, context, row->id, "not found");
+        free_student_record(row);
+        return true;
+    }
+    MarkList merged;
+    int over_limit;
+    bool merged_ok = mark_list_merge(student_marks(index), &row->marks, &merged, &over_limit);
+    free_student_record(row);
+    if (!merged_ok) {
+        if (over_limit == 0) return false;
+        char reason[64];
+        mark_limit_reason(over_limit, reason, sizeof(reason));
+        merge_conflict(report, on_conflict, context, student_id(index), reason);
+        return true;
+    }
+    const MarkList *current = student_marks(index);
+    if (merged.count == current->count &&
+        (merged.count == 0 || memcmp(merged.cells, current->cells, merged.count * sizeof(MarkCell)) == 0)) {
+        mark_list_release(&merged);
+        report->unchanged++;
+        return true;
+    }
+    Student record;
+    student_load(index, &record);
+    MarkList old = record.marks;
+    record.marks = merged;
+    student_store_at(index, &record);
+    mark_list_release(&old);
+    wal_log_upsert(index);
+    report->updated++;
+    return true;
+}
+
+// Merges an external CSV into the store. A file whose header is exactly
+// "ID,MarksData" holds marks deltas, folded into existing students; any other
+// file holds full rows in the students.csv format, inserted or replacing the
+// stored record. Rows are parsed in parallel, sorted by ID and deduplicated
+// (exact repeats collapse, differing repeats are a conflict), then merge-joined
+// against id_order in one pass. Every change is logged. Caller holds store_lock.
+// Returns false if the file cannot be read or memory runs out part-way.
+bool merge_students_from_file(const char *filename, MergeReport *report, MergeConflictFn on_conflict, void *context) {
+    *report = (MergeReport){ 0, 0, 0, 0, 0, 0 };
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return false; }
+    size_t length = (size_t)st.st_size;
+    if (length == 0) { close(fd); return true; }
+    const char *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    posix_madvise((void *)data, length, POSIX_MADV_WILLNEED);
+
+    static const char delta_header[] = "ID,MarksData";
+    const char *end = data + length;
+    const char *body = memchr(data, '\n', length);
+    body = body ? body + 1 : end;
+    size_t header_length = (size_t)(body - data);
+    while (header_length > 0 && (data[header_length - 1] == '\n' || data[header_length - 1] == '\r')) header_length--;
+    bool marks_only = header_length == sizeof(delta_header) - 1 && memcmp(data, delta_header, header_length) == 0;
+
+    ImportChunk chunks[IMPORT_MAX_THREADS];
+    int thread_count = import_parse(body, end, filename, marks_only, chunks);
+    size_t total = 0;
+    bool out_of_memory = false;
+    for (int t = 0; t < thread_count; t++) {
+        total += chunks[t].count;
+        report->rejected += chunks[t].rejected;
+        if (chunks[t].out_of_memory) out_of_memory = true;
+    }
+    ImportRow **rows = out_of_memory || total == 0 ? NULL : malloc(total * sizeof(ImportRow *));
+    if (rows == NULL && total > 0) out_of_memory = true;
+
+    bool order_was_deferred = id_order.deferred, marks_were_deferred = mark_index.deferred;
+    if (!out_of_memory && id_order.deferred && !id_order_build()) out_of_memory = true;
+    size_t existing = id_order.size;
+    bool joined = !out_of_memory;
+    if (joined) {
+        size_t n = 0;
+        for (int t = 0; t < thread_count; t++) {
+            for (size_t i = 0; i < chunks[t].count; i++) rows[n++] = &chunks[t].rows[i];
+        }
+        if (total > 1) qsort(rows, total, sizeof(ImportRow *), merge_row_compare);
+        id_index_reserve((size_t)student_count() + total);
+        // The join walks id_order.entries; inserts leave it alone while deferred.
+        id_order.deferred = true;
+        mark_index.deferred = true;
+
+        size_t cursor = 0;
+        for (size_t i = 0, run; i < total; i = run) {
+            Student *row = &rows[i]->student;
+            bool repeats_agree = true;
+            for (run = i + 1; run < total && strcmp(rows[run]->student.id, row->id) == 0; run++) {
+                repeats_agree = repeats_agree && rows[run]->line_length == rows[i]->line_length &&
+                                memcmp(rows[run]->line, rows[i]->line, rows[i]->line_length) == 0;
+                free_student_record(&rows[run]->student);
+            }
+            if (out_of_memory) { free_student_record(row); continue; }
+            if (!repeats_agree) {
+                merge_conflict(report, on_conflict, context, row->id, "conflicting rows in file");
+                free_student_record(row);
+                continue;
+            }
+            report->duplicates += run - i - 1;
+            // Deleted records awaiting compaction keep their entries; a live one may share the ID.
+            while (cursor < existing && (!student_is_live(id_order.entries[cursor]) ||
+                                         strcmp(student_id(id_order.entries[cursor]), row->id) < 0)) cursor++;
+            int index = cursor < existing && strcmp(student_id(id_order.entries[cursor]), row->id) == 0
+                ? id_order.entries[cursor] : -1;
+            bool applied = marks_only ? merge_apply_delta(row, index, report, on_conflict, context)
+                                      : merge_apply_row(row, index, report);
+            if (!applied) out_of_memory = true;
+        }
+    } else {
+        for (int t = 0; t < thread_count; t++) {
+            for (size_t i = 0; i < chunks[t].count; i++) free_student_record(&chunks[t].rows[i].student);
+        }
+    }
+    free(rows);
+    for (int t = 0; t < thread_count; t++) free(chunks[t].rows);
+    munmap((void *)data, length);
+
+    // Indexes that were live before the merge are live again afterwards.
+    if (joined && report->inserted == 0) {
+        id_order.deferred = false; // Built above and untouched since.
+    } else if (joined && !order_was_deferred && !id_order_build()) {
+        fprintf(stderr, "Memory error: could not build ordered ID index.\n");
+    }
+    if (joined && report->inserted + report->updated == 0) {
+        mark_index.deferred = marks_were_deferred;
+    } else if (joined && !marks_were_deferred && !mark_index_build()) {
+        fprintf(stderr, "Memory error: mark index may be incomplete.\n");
+    }
+    if (out_of_memory) fprintf(stderr, "Memory error: could not merge all of %s.\n", filename);
+    return !out_of_memory;
+}
+
+static bool output_open(OutputWriter *out, const char *filename) {
+    string_buffer_init(&out->buffer);
+    out->flushed = 0;
+    out->failed = false;
+    out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out->fd < 0) return false;
+    if (!string_buffer_reserve(&out->buffer, OUTPUT_BUFFER_SIZE)) {
+        close(out->fd);
+        out->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Writes every byte of `iov`, retrying short writes and EINTR.
+static bool output_writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t done = (size_t)n;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+// Sends the buffered bytes followed by `data` in a single writev(), so large
+// payloads go to the kernel without being copied into the buffer first.
+static bool output_flush_with(OutputWriter *out, const void *data, size_t length) {
+    if (out->failed) return false;
+    struct iovec iov[2];
+    int count = 0;
+    if (out->buffer.length > 0) {
+        iov[count].iov_base = out->buffer.data;
+        iov[count++].iov_len = out->buffer.length;
+    }
+    if (length > 0) {
+        iov[count].iov_base = (void *)data;
+        iov[count++].iov_len = length;
+    }
+    if (!output_writev_all(out->fd, iov, count)) {
+        out->failed = true;
+        return false;
+    }
+    out->flushed += out->buffer.length + length;
+    string_buffer_clear(&out->buffer);
+    return true;
+}
+
+static bool output_flush(OutputWriter *out) {
+    return output_flush_with(out, NULL, 0);
+}
+
+static bool output_write(OutputWriter *out, const void *data, size_t length) {
+    if (out->buffer.length + length < OUTPUT_BUFFER_SIZE) {
+        return string_buffer_append_n(&out->buffer, data, length);
+    }
+    return output_flush_with(out, data, length);
+}
+
+// Called after formatting directly into `out->buffer`; flushes once the buffer
+// is nearly full so the next row still fits without reallocating.
+static bool output_commit(OutputWriter *out) {
+    if (out->buffer.length + OUTPUT_ROW_HEADROOM < OUTPUT_BUFFER_SIZE) return !out->failed;
+    return output_flush(out);
+}
+
+static size_t output_position(const OutputWriter *out) {
+    return out->flushed + out->buffer.length;
+}
+
+// Flushes and forces the file contents to stable storage.
+static bool output_sync(OutputWriter *out) {
+    return output_flush(out) && fsync(out->fd) == 0;
+}
+
+static string parent_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? string_copy_n(path, slash == path ? 1 : (size_t)(slash - path)) : string_copy_n(".", 1);
+}
+
+// A rename is only guaranteed to survive a crash once the directory holding
+// the new entry has been fsynced as well.
+static bool sync_directory(const char *directory) {
+    int fd = open(directory, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static bool sync_parent_directory(const char *path) {
+    string directory = parent_directory(path);
+    bool ok = directory != NULL && sync_directory(directory);
+    free(directory);
+    return ok;
+}
+
+// Atomically replaces `path` with the already-synced `temp_path`. Readers and
+// crash recovery see either the old file or the new one, never a partial write.
+static bool replace_file_durably(const char *temp_path, const char *path) {
+    return rename(temp_path, path) == 0 && sync_parent_directory(path);
+}
+
+// Writes the NULL-terminated pieces and a newline to stderr with write(2), which
+// unlike stdio is safe in a child forked from this multithreaded process.
+static void save_error(const char *piece, ...) {
+    va_list pieces;
+    va_start(pieces, piece);
+    ssize_t written = 0;
+    for (; written >= 0 && piece != NULL; piece = va_arg(pieces, const char *)) {
+        written = write(STDERR_FILENO, piece, strlen(piece));
+    }
+    va_end(pieces);
+    if (written >= 0) written = write(STDERR_FILENO, "\n", 1);
+    (void)written;
+}
+
+static void save_target_release(SaveTarget *target) {
+    if (target->out.fd >= 0) close(target->out.fd);
+    string_buffer_free(&target->out.buffer);
+    free(target->temp_path);
+    free(target->directory);
+    target->out.fd = -1;
+    target->temp_path = NULL;
+    target->directory = NULL;
+}
+
+// Opens `<path>.tmp` for writing and allocates the paths and output buffer the
+// save will need. Reports failures.
+static bool save_target_open(SaveTarget *target, const char *path) {
+    *target = (SaveTarget){ path, NULL, NULL, { -1, { NULL, 0, 0 }, 0, false } };
+    target->temp_path = string_concat((const string)path, TEMP_FILE_SUFFIX);
+    target->directory = parent_directory(path);
+    if (target->temp_path == NULL || target->directory == NULL || !output_open(&target->out, target->temp_path)) {
+        fprintf(stderr, "Error: Could not open file %s%s for writing.\n", path, TEMP_FILE_SUFFIX);
+        save_target_release(target);
+        return false;
+    }
+    return true;
+}
+
+// Fsyncs and closes the temp file, renames it over the target and fsyncs the
+// directory. If `ok` is false or a step fails, removes it and keeps the previous
+// copy. Uses system calls only, so a forked child can run it.
+static bool save_target_commit(SaveTarget *target, bool ok) {
+    ok = ok && output_sync(&target->out);
+    if (close(target->out.fd) != 0) ok = false;
+    target->out.fd = -1;
+    ok = ok && rename(target->temp_path, target->path) == 0 && sync_directory(target->directory);
+    if (!ok) {
+        save_error("Error: Could not write ", target->path, "; the previous copy was left in place.", (const char *)NULL);
+        unlink(target->temp_path);
+    }
+    return ok;
+}
+
+// Writes every live student as CSV. Rows are formatted straight into the
+// preallocated buffer; only a row longer than OUTPUT_ROW_HEADROOM grows it.
+bool write_students_csv(SaveTarget *target) {
+    OutputWriter *out = &target->out;
+    static const char header[] = "ID,Name,Age,Major,MarksData\n";
+    bool ok = output_write(out, header, sizeof(header) - 1);
+    for (int i = 0; ok && i < student_store.count; i++) {
+        if (!student_is_live(i)) continue;
+        size_t row_start = out->buffer.length;
+        if (!format_student_line(i, &out->buffer)) {
+            out->buffer.length = row_start;
+            save_error("Error formatting student ", student_name(i), " (ID: ", student_id(i),
+                       "). Data for this student might be lost or incomplete in save.", (const char *)NULL);
+            continue;
+        }
+        ok = output_commit(out);
+    }
+    return ok;
+}
+
+// Writes to `<filename>.tmp`, fsyncs it and renames it over `filename`, so a
+// crash mid-save leaves the previous export intact.
+bool save_students_to_file(const char *filename) {
+    SaveTarget target;
+    if (!save_target_open(&target, filename)) return false;
+    bool ok = save_target_commit(&target, write_students_csv(&target));
+    save_target_release(&target);
+    return ok;
+}
+
+// A crash can leave a partial last record, which replay_wal ignores. Cut it off
+// so that records appended from now on start on a fresh line.
+static void wal_drop_torn_tail(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+    char block[4096];
+    off_t keep = 0;
+    for (off_t end = st.st_size; end > 0 && keep == 0; ) {
+        size_t length = end < (off_t)sizeof(block) ? (size_t)end : sizeof(block);
+        off_t start = end - (off_t)length;
+        if (pread(fd, block, length, start) != (ssize_t)length) return;
+        for (size_t i = length; i > 0 && keep == 0; i--) {
+            if (block[i - 1] == '\n') keep = start + (off_t)i;
+        }
+        end = start;
+    }
+    if (keep < st.st_size && ftruncate(fd, keep) != 0) {
+        fprintf(stderr, "Warning: Could not remove incomplete last record from %s.\n", WAL_FILE);
+    }
+}
+
+// Opens the write-ahead log for appending. Each mutation appends one line:
+//   "+<CSV row>"  insert or replace the record with that ID
+//   "-<ID>"       delete the record with that ID
+// Replaying a record twice has the same effect as replaying it once, so a crash
+// between writing a checkpoint and truncating the log is harmless.
+bool wal_open(const char *filename) {
+    wal_fd = open(filename, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (wal_fd < 0) {
+        fprintf(stderr, "Error: Could not open write-ahead log %s.\n", filename);
+        return false;
+    }
+    wal_drop_torn_tail(wal_fd);
+    return true;
+}
+
+// Writes every pending record with one write and one fsync. Caller holds wal_io_lock.
+// On failure the batch is kept and the coalescing timer restarted, so the autosave
+// thread retries when it expires instead of waiting for another change.
+static bool wal_flush_locked(void) {
+    pthread_mutex_lock(&wal_lock);
+    if (wal_writing.length == 0) {
+        string_buffer swap = wal_writing;
+        wal_writing = wal_pending;
+        wal_pending = swap;
+    } else if (!string_buffer_append_n(&wal_writing, wal_pending.data, wal_pending.length)) {
+        pthread_mutex_unlock(&wal_lock);
+        return false;
+    }
+    string_buffer_clear(&wal_pending);
+    wal_pending_records = 0;
+    pthread_mutex_unlock(&wal_lock);
+
+    if (wal_writing.length == 0 || wal_fd < 0) return true;
+    struct iovec iov = { wal_writing.data, wal_writing.length };
+    bool ok = output_writev_all(wal_fd, &iov, 1) && fsync(wal_fd) == 0;
+    pthread_mutex_lock(&wal_lock);
+    wal_retry_pending = !ok;
+    if (!ok) {
+        wal_pending_records++;
+        clock_gettime(CLOCK_MONOTONIC, &wal_first_pending);
+    }
+    pthread_mutex_unlock(&wal_lock);
+    if (!ok) {
+        fprintf(stderr, "Error: Could not write to %s. Recent changes may not be durable.\n", WAL_FILE);
+        return false;
+    }
+    string_buffer_clear(&wal_writing);
+    return true;
+}
+
+bool wal_flush(void) {
+    pthread_mutex_lock(&wal_io_lock);
+    bool ok = wal_flush_locked();
+    pthread_mutex_unlock(&wal_io_lock);
+    return ok;
+}
+
+// True if changes have been made that are not in the log file: a flush failed,
+// batch mode has not flushed yet, or the log could not be opened at all.
+static bool wal_unwritten(void) {
+    pthread_mutex_lock(&wal_io_lock);
+    pthread_mutex_lock(&wal_lock);
+    bool unwritten = wal_fd < 0 || wal_pending.length > 0 || wal_writing.length > 0;
+    pthread_mutex_unlock(&wal_lock);
+    pthread_mutex_unlock(&wal_io_lock);
+    return unwritten;
+}
+
+void wal_close(void) {
+    wal_flush();
+    if (wal_fd >= 0) close(wal_fd);
+    wal_fd = -1;
+    string_buffer_free(&wal_pending);
+    string_buffer_free(&wal_writing);
+}
+
+// Caller holds wal_lock. Marks the store dirty: wakes the autosave thread to start
+// its timer, or to write right away once enough log has built up.
+static void wal_record_added(void) {
+    wal_records_since_checkpoint++;
+    if (wal_pending_records++ == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &wal_first_pending);
+        pthread_cond_signal(&wal_wake); // Start the coalescing timer.
+    } else if (wal_pending.length >= autosave.max_pending_bytes ||
+               wal_records_since_checkpoint >= WAL_CHECKPOINT_INTERVAL) {
+        pthread_cond_signal(&wal_wake);
+    }
+}
+
+// O(size of one record). Only buffers the record; the autosave thread makes it durable.
+void wal_log_upsert(int index) {
+    if (wal_fd < 0) return;
+    pthread_mutex_lock(&wal_lock);
+    size_t start = wal_pending.length;
+    if (string_buffer_append_char(&wal_pending, '+') && format_student_line(index, &wal_pending)) {
+        wal_record_added();
+    } else {
+        wal_pending.length = start;
+        fprintf(stderr, "Memory error: could not log change to student %s.\n", student_id(index));
+    }
+    pthread_mutex_unlock(&wal_lock);
+    if (!autosave.running && !wal_deferred) wal_flush();
+}
+
+void wal_log_delete(const char *id) {
+    if (wal_fd < 0) return;
+    pthread_mutex_lock(&wal_lock);
+    size_t start = wal_pending.length;
+    if (string_buffer_append_char(&wal_pending, '-') &&
+        string_buffer_append(&wal_pending, id) &&
+        string_buffer_append_char(&wal_pending, '\n')) {
+        wal_record_added();
+    } else {
+        wal_pending.length = start;
+        fprintf(stderr, "Memory error: could not log deletion of student %s.\n", id);
+    }
+    pthread_mutex_unlock(&wal_lock);
+    if (!autosave.running && !wal_deferred) wal_flush();
+}
+
+// Inserts `s`, or replaces the record with the same ID in place. Takes ownership of s's strings.
+static bool apply_upsert(Student *s) {
+    int index = find_student_by_id(s->id);
+    if (index == -1) {
+        bool stored = store_append(s);
+        if (stored && index_student(student_store.count - 1)) return true;
+        if (stored) student_store.count--;
+        free_student_record(s);
+        return false;
+    }
+    // Same ID, so only the mark postings change.
+    unindex_student_marks(index);
+    student_release_at(index);
+    student_store_at(index, s);
+    return index_student_marks(index);
+}
+
+static void apply_delete(const char *id) {
+    int index = find_student_by_id((const string)id);
+    if (index == -1) return;
+    store_remove_at(index);
+}
+
+// Re-applies every complete record in the log. A torn final line (no newline)
+// is the tail of an interrupted append and is ignored. Returns records applied, or -1.
+int replay_wal(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) return -1;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+    int applied = 0;
+    while ((line_length = getline(&line, &line_capacity, file)) != -1) {
+        if (line[line_length - 1] != '\n') {
+            fprintf(stderr, "Warning: Ignoring incomplete last record in %s.\n", filename);
+            break;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '+') {
+            Student s;
+            if (!parse_student_line(line + 1, strlen(line + 1), &s, filename, &record_heap)) continue;
+            if (!apply_upsert(&s)) {
+                fprintf(stderr, "Memory error: could not apply log record: %s\n", line);
+                continue;
+            }
+        } else if (line[0] == '-') {
+            apply_delete(line + 1);
+        } else if (line[0] != '\0') {
+            fprintf(stderr, "Warning: Unknown record type in %s: %s. Skipping.\n", filename, line);
+            continue;
+        }
+        applied++;
+    }
+    free(line);
+    fclose(file);
+    wal_records_since_checkpoint = applied;
+    return applied;
+}
+
+// Cuts `text` after its first word and returns the rest, with leading blanks
+// skipped ("" if there is none).
+static char *batch_split(char *text) {
+    char *rest = text + strcspn(text, " \t");
+    if (*rest == '\0') return rest;
+    *rest++ = '\0';
+    return rest + strspn(rest, " \t");
+}
+
+static bool batch_id_valid(const char *id) {
+    return *id != '\0' && strlen(id) <= MAX_ID_LENGTH && string_is_digit((string)id);
+}
+
+static bool batch_ok(BatchContext *batch, const char *command, const char *detail) {
+    fprintf(batch->out, "ok\t%d\t%s", batch->line, command);
+    if (detail != NULL) fprintf(batch->out, "\t%s", detail);
+    fputc('\n', batch->out);
+    return true;
+}
+
+// Reports the failure and returns false, so commands can `return batch_error(...)`.
+static bool batch_error(BatchContext *batch, const char *command, const char *message) {
+    fprintf(batch->out, "error\t%d\t%s\t%s\n", batch->line, command, message);
+    return false;
+}
+
+static bool batch_ok_count(BatchContext *batch, const char *command, size_t count) {
+    char detail[24];
+    snprintf(detail, sizeof(detail), "%zu", count);
+    return batch_ok(batch, command, detail);
+}
+
+static bool batch_row(BatchContext *batch, int index) {
+    string_buffer_clear(&batch->row);
+    if (!format_student_line(index, &batch->row)) return false;
+    fprintf(batch->out, "row\t%d\t", batch->line);
+    fwrite(batch->row.data, 1, batch->row.length, batch->out);
+    return true;
+}
+
+// add <CSV row> inserts a new student; put <CSV row> inserts or replaces one.
+static bool batch_store_row(BatchContext *batch, const char *command, char *args, bool replace) {
+    Student s;
+    if (!parse_student_line(args, strlen(args), &s, "batch input", &record_heap)) {
+        return batch_error(batch, command, "invalid row");
+    }
+    int over_limit = mark_list_over_limit(&s.marks);
+    if (over_limit != 0) {
+        char message[64];
+        mark_limit_reason(over_limit, message, sizeof(message));
+        free_student_record(&s);
+        return batch_error(batch, command, message);
+    }
+    bool exists = find_student_by_id(s.id) != -1;
+    if (exists && !replace) {
+        free_student_record(&s);
+        return batch_error(batch, command, "duplicate ID");
+    }
+    char id[MAX_ID_LENGTH + 1];
+    memcpy(id, s.id, sizeof(id));
+    pthread_mutex_lock(&store_lock);
+    bool stored = apply_upsert(&s);
+    if (stored) wal_log_upsert(find_student_by_id(id));
+    pthread_mutex_unlock(&store_lock);
+    if (!stored) return batch_error(batch, command, "out of memory");
+    return batch_ok(batch, command, exists ? "updated" : "inserted");
+}
+
+static bool batch_add(BatchContext *batch, const char *command, char *args) {
+    return batch_store_row(batch, command, args, false);
+}
+
+static bool batch_put(BatchContext *batch, const char *command, char *args) {
+    return batch_store_row(batch, command, args, true);
+}
+
+// marks <ID> <MarksData>: sets each listed subject's mark, adding subjects and
+// semesters the student does not have yet.
+static bool batch_marks(BatchContext *batch, const char *command, char *args) {
+    char *marks = batch_split(args);
+    if (!batch_id_valid(args)) return batch_error(batch, command, "invalid ID");
+    int index = find_student_by_id(args);
+    if (index == -1) return batch_error(batch, command, "not found");
+    MarkList delta, merged;
+    if (!parse_marks_from_string(&delta, marks, strlen(marks), &record_heap)) {
+        return batch_error(batch, command, "out of memory");
+    }
+    if (mark_list_subject_count(&delta) == 0) {
+        mark_list_release(&delta);
+        return batch_error(batch, command, "no valid marks");
+    }
+    int over_limit;
+    bool merged_ok = mark_list_merge(student_marks(index), &delta, &merged, &over_limit);
+    mark_list_release(&delta);
+    if (!merged_ok) {
+        char message[64];
+        if (over_limit != 0) mark_limit_reason(over_limit, message, sizeof(message));
+        else snprintf(message, sizeof(message), "out of memory");
+        return batch_error(batch, command, message);
+    }
+    Student row;
+    pthread_mutex_lock(&store_lock);
+    unindex_student_marks(index);
+    student_load(index, &row);
+    MarkList old = row.marks;
+    row.marks = merged;
+    student_store_at(index, &row);
+    bool indexed = index_student_marks(index);
+    if (!indexed) {
+        row.marks = old;
+        student_store_at(index, &row);
+        index_student_marks(index);
+        mark_list_release(&merged);
+    } else {
+        mark_list_release(&old);
+        wal_log_upsert(index);
+    }
+    pthread_mutex_unlock(&store_lock);
+    if (!indexed) return batch_error(batch, command, "out of memory");
+    return batch_ok(batch, command, NULL);
+}
+
+static bool batch_delete(BatchContext *batch, const char *command, char *args) {
+    if (!batch_id_valid(args)) return batch_error(batch, command, "invalid ID");
+    int index = find_student_by_id(args);
+    if (index == -1) return batch_error(batch, command, "not found");
+    pthread_mutex_lock(&store_lock);
+    wal_log_delete(args);
+    store_remove_at(index);
+    pthread_mutex_unlock(&store_lock);
+    return batch_ok(batch, command, NULL);
+}
+
+static bool batch_get(BatchContext *batch, const char *command, char *args) {
+    if (!batch_id_valid(args)) return batch_error(batch, command, "invalid ID");
+    int index = find_student_by_id(args);
+    if (index == -1) return batch_error(batch, command, "not found");
+    if (!batch_row(batch, index)) return batch_error(batch, command, "out of memory");
+    return batch_ok_count(batch, command, 1);
+}
+
+// prefix <digits>: every student whose ID starts with them, ascending by ID.
+static bool batch_prefix(BatchContext *batch, const char *command, char *args) {
+    if (!batch_id_valid(args)) return batch_error(batch, command, "invalid ID prefix");
+    if (id_order.deferred && !id_order_build()) return batch_error(batch, command, "out of memory");
+    size_t first, count = 0;
+    size_t run = id_order_prefix_range(args, &first);
+    for (size_t i = first; i < first + run; i++) {
+        int record = id_order.entries[i];
+        if (!student_is_live(record)) continue;
+        if (!batch_row(batch, record)) return batch_error(batch, command, "out of memory");
+        count++;
+    }
+    return batch_ok_count(batch, command, count);
+}
+
+// mark <semester> <subject> <minimum>: students with at least `minimum` in the
+// subject that semester, highest mark first. The subject may contain spaces.
+static bool batch_mark(BatchContext *batch, const char *command, char *args) {
+    char *subject = batch_split(args);
+    char *minimum = strrchr(subject, ' ');
+    bool semester_ok, minimum_ok = false;
+    int semester = string_n_to_int(args, strlen(args), &semester_ok);
+    int min_mark = 0;
+    if (minimum != NULL) {
+        *minimum++ = '\0';
+        min_mark = string_n_to_int(minimum, strlen(minimum), &minimum_ok);
+    }
+    if (!semester_ok || semester < 1 || semester > MARKS_LIMIT_CEILING || !minimum_ok ||
+        min_mark < 0 || min_mark > MAX_MARK || *subject == '\0') {
+        return batch_error(batch, command, "usage: mark <semester> <subject> <minimum>");
+    }
+    if (mark_index.deferred && !mark_index_build()) return batch_error(batch, command, "out of memory");
+    Symbol symbol = symbol_lookup(subject);
+    PostingList *list = symbol == SYMBOL_NONE ? NULL : mark_index_find(semester, symbol);
+    size_t count = 0;
+    if (list) {
+        size_t lo = mark_index_first_at_least(list, min_mark);
+        for (size_t i = list->size; i-- > lo; ) {
+            int record = list->postings[i].record;
+            if (!student_is_live(record)) continue;
+            if (!batch_row(batch, record)) return batch_error(batch, command, "out of memory");
+            count++;
+        }
+    }
+    return batch_ok_count(batch, command, count);
+}
+
+// query <filter>: every student matching a filter expression (see query_compile), ascending by ID.
+static bool batch_query(BatchContext *batch, const char *command, char *args) {
+    Query query;
+    char error[128];
+    if (!query_compile(args, &query, error, sizeof(error))) return batch_error(batch, command, error);
+    // Like prefix and mark, rebuild a deferred index the filter can use.
+    bool ok = true;
+    for (size_t i = 0; ok && i < query.hint_count; i++) {
+        const QueryInstr *instr = &query.code[query.hints[i]];
+        if (instr->op == QUERY_MARK && mark_index.deferred) ok = mark_index_build();
+        if (instr->op == QUERY_ID && instr->cmp != QUERY_EQ && id_order.deferred) ok = id_order_build();
+    }
+    int *matches = NULL;
+    size_t count = 0;
+    ok = ok && query_run(&query, &matches, &count);
+    query_free(&query);
+    for (size_t i = 0; ok && i < count; i++) ok = batch_row(batch, matches[i]);
+    free(matches);
+    if (!ok) return batch_error(batch, command, "out of memory");
+    return batch_ok_count(batch, command, count);
+}
+
+// stats: per-subject totals over every student, one "subject" line each, by name.
+static bool batch_stats(BatchContext *batch, const char *command, char *args) {
+    (void)args;
+    SubjectStats *subjects;
+    size_t subject_count;
+    if (!marks_aggregate(&subjects, &subject_count, NULL, NULL)) return batch_error(batch, command, "out of memory");
+    for (size_t i = 0; i < subject_count; i++) {
+        const SubjectStats *stats = &subjects[i];
+        fprintf(batch->out, "subject\t%d\t%s\t%zu\t%.2f\t%d\t%d\t%.2f\n", batch->line,
+                symbol_text(stats->subject, ""), stats->count, subject_stats_mean(stats),
+                stats->min, stats->max, subject_stats_stddev(stats));
+    }
+    free(subjects);
+    return batch_ok_count(batch, command, subject_count);
+}
+
+static void batch_grades_row(void *context, int record, const StudentGrades *grades) {
+    BatchContext *batch = context;
+    fprintf(batch->out, "grades\t%d\t%s\t%d\t", batch->line, student_id(record), grades->subjects);
+    if (grades->subjects == 0) {
+        fputs("-\t-\t\n", batch->out);
+        return;
+    }
+    fprintf(batch->out, "%.2f\t%.2f\t", grades->average, grades->cgpa);
+    for (size_t i = 0; i < grades->semester_count; i++) {
+        fprintf(batch->out, "%sS%d=%.2f", i > 0 ? ";" : "", grades->semesters[i].semester, grades->semesters[i].gpa);
+    }
+    fputc('\n', batch->out);
+}
+
+// grades [ID]: subjects, average, CGPA and per-semester GPA for one student, or
+// for every student in ascending ID order.
+static bool batch_grades(BatchContext *batch, const char *command, char *args) {
+    if (*args != '\0') {
+        if (!batch_id_valid(args)) return batch_error(batch, command, "invalid ID");
+        int index = find_student_by_id(args);
+        if (index == -1) return batch_error(batch, command, "not found");
+        GradeBuffer buffer = { NULL, NULL, NULL, 0 };
+        StudentGrades grades;
+        bool ok = student_grades(student_marks(index), &buffer, &grades);
+        if (ok) batch_grades_row(batch, index, &grades);
+        grade_buffer_free(&buffer);
+        return ok ? batch_ok_count(batch, command, 1) : batch_error(batch, command, "out of memory");
+    }
+    if (id_order.deferred && !id_order_build()) return batch_error(batch, command, "out of memory");
+    SubjectStats *subjects;
+    size_t subject_count;
+    if (!marks_aggregate(&subjects, &subject_count, batch_grades_row, batch)) {
+        return batch_error(batch, command, "out of memory");
+    }
+    free(subjects);
+    return batch_ok_count(batch, command, (size_t)student_count());
+}
+
+// top|bottom <k> <metric> [where <filter>]: the k best (or worst) students by a
+// metric (see rank_compile), one "rank" line each, best first.
+static bool batch_rank(BatchContext *batch, const char *command, char *args, bool highest) {
+    char *metric_text = batch_split(args);
+    bool ok;
+    int k = string_n_to_int(args, strlen(args), &ok);
+    if (!ok || k < 1) return batch_error(batch, command, "usage: top|bottom <k> <metric> [where <filter>]");
+    RankMetric metric;
+    Query filter;
+    char error[128];
+    if (!rank_compile(metric_text, &metric, &filter, error, sizeof(error))) return batch_error(batch, command, error);
+    // A subject mark is ranked straight from its posting list, so rebuild it like "mark" does.
+    ok = metric.kind != RANK_MARK || !mark_index.deferred || mark_index_build();
+    RankEntry *entries = NULL;
+    size_t count = 0;
+    ok = ok && rank_students(&metric, &filter, (size_t)k, highest, &entries, &count);
+    query_free(&filter);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(batch->out, "rank\t%d\t%zu\t%s\t", batch->line, i + 1, student_id(entries[i].record));
+        fprintf(batch->out, rank_metric_is_integer(&metric) ? "%.0f\n" : "%.2f\n", entries[i].value);
+    }
+    free(entries);
+    if (!ok) return batch_error(batch, command, "out of memory");
+    return batch_ok_count(batch, command, count);
+}
+
+static bool batch_top(BatchContext *batch, const char *command, char *args) {
+    return batch_rank(batch, command, args, true);
+}
+
+static bool batch_bottom(BatchContext *batch, const char *command, char *args) {
+    return batch_rank(batch, command, args, false);
+}
+
+static void batch_merge_conflict(void *context, const char *id, const char *reason) {
+    BatchContext *batch = context;
+    fprintf(batch->out, "conflict\t%d\t%s\t%s\n", batch->line, id, reason);
+}
+
+// merge <file>: bulk-merges a CSV (see merge_students_from_file). Each skipped ID
+// gets a "conflict" line; the summary counts go on the "ok" line.
+static bool batch_merge(BatchContext *batch, const char *command, char *args) {
+    if (*args == '\0') return batch_error(batch, command, "usage: merge <file>");
+    MergeReport report;
+    pthread_mutex_lock(&store_lock);
+    bool merged = merge_students_from_file(args, &report, batch_merge_conflict, batch);
+    pthread_mutex_unlock(&store_lock);
+    if (!merged) return batch_error(batch, command, "could not read file or out of memory");
+    char detail[192];
+    snprintf(detail, sizeof(detail), "inserted=%zu\tupdated=%zu\tunchanged=%zu\tduplicates=%zu\tconflicts=%zu\tinvalid=%zu",
+             report.inserted, report.updated, report.unchanged, report.duplicates, report.conflicts, report.rejected);
+    return batch_ok(batch, command, detail);
+}
+
+static const BatchCommand batch_commands[] = {
+    { "add", batch_add },
+    { "put", batch_put },
+    { "marks", batch_marks },
+    { "delete", batch_delete },
+    { "get", batch_get },
+    { "prefix", batch_prefix },
+    { "mark", batch_mark },
+    { "query", batch_query },
+    { "stats", batch_stats },
+    { "grades", batch_grades },
+    { "top", batch_top },
+    { "bottom", batch_bottom },
+    { "merge", batch_merge },
+};
+
+// Runs the commands in `path` ("-" for stdin) without prompts, one per line;
+// blank lines and lines starting with '#' are skipped. Changes are persisted once,
+// at the end: the buffered log is written with a single fsync and folded into a
+// fresh snapshot, and the CSV is exported. The last line of output is
+// "done<TAB>commands<TAB>failed<TAB>saved|unsaved". Returns the process exit status.
+int run_batch(const char *path) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Error: Could not open batch file %s.\n", path);
+        return EXIT_FAILURE;
+    }
+    open_database(stderr);
+    wal_deferred = true;
+    wal_open(WAL_FILE);
+    // Writes skip the ordered indexes; the first query that needs one rebuilds it.
+    id_order.deferred = true;
+    mark_index.deferred = true;
+
+    BatchContext batch = { stdout, { NULL, 0, 0 }, 0, 0, 0 };
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, in) != -1) {
+        batch.line++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *command = line + strspn(line, " \t");
+        if (*command == '\0' || *command == '#') continue;
+        char *args = batch_split(command);
+        const BatchCommand *entry = NULL;
+        for (size_t i = 0; entry == NULL && i < sizeof(batch_commands) / sizeof(batch_commands[0]); i++) {
+            if (strcmp(batch_commands[i].name, command) == 0) entry = &batch_commands[i];
+        }
+        batch.commands++;
+        bool ok = entry ? entry->run(&batch, command, args) : batch_error(&batch, command, "unknown command");
+        if (!ok) batch.failed++;
+    }
+    free(line);
+    if (in != stdin) fclose(in);
+    string_buffer_free(&batch.row);
+
+    fflush(batch.out); // Before the checkpoint forks, so the child holds no unwritten output.
+    bool saved = checkpoint_database();
+    if (!saved) {
+        report_checkpoint_failure("Could not save the batch.");
+    } else if (!save_students_to_file(DATABASE_FILE)) {
+        fprintf(stderr, "Error: Could not export data to %s.\n", DATABASE_FILE);
+    }
+    fprintf(batch.out, "done\t%d\t%d\t%s\n", batch.commands, batch.failed, saved ? "saved" : "unsaved");
+    wal_close();
+    store_release();
+    return saved && batch.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Folds the log into the snapshot: rewrite the binary snapshot, then empty the log.
+// Caller holds store_lock. Forks a child that runs `writer` against the store exactly
+// as it is now; copy-on-write keeps that view frozen while the parent goes on mutating.
+// The target is opened first, so the child allocates nothing and uses no stdio. The
+// fork also holds symbols.lock, since symbol_intern may grow the table outside store_lock.
+// If fork fails, saves in-process instead (blocking writers) and returns -1 with `*saved` set.
+static pid_t fork_frozen_save(SaveWriter writer, const char *path, bool *saved) {
+    *saved = false;
+    SaveTarget target;
+    if (!save_target_open(&target, path)) return -1;
+    pthread_rwlock_rdlock(&symbols.lock);
+    pid_t pid = fork();
+    if (pid == 0) _exit(save_target_commit(&target, writer(&target)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    if (pid < 0) *saved = save_target_commit(&target, writer(&target));
+    pthread_rwlock_unlock(&symbols.lock);
+    save_target_release(&target);
+    return pid;
+}
+
+// Returns true once the save started by fork_frozen_save has finished, with its result in `*ok`.
+static bool frozen_save_done(pid_t pid, bool saved, bool block, bool *ok) {
+    if (pid < 0) {
+        *ok = saved;
+        return true;
+    }
+    int status;
+    pid_t result;
+    while ((result = waitpid(pid, &status, block ? 0 : WNOHANG)) < 0 && errno == EINTR) {}
+    if (result == 0) return false;
+    *ok = result == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    return true;
+}
+
+// Saves a point-in-time view of the store without holding store_lock while it streams.
+bool save_frozen(SaveWriter writer, const char *path) {
+    bool saved = false;
+    pthread_mutex_lock(&store_lock);
+    pid_t pid = fork_frozen_save(writer, path, &saved);
+    pthread_mutex_unlock(&store_lock);
+    bool ok;
+    frozen_save_done(pid, saved, true, &ok);
+    return ok;
+}
+
+// Caller holds wal_io_lock. Replaces the log with the records after byte `cut`, which a
+// checkpoint has made redundant. The tail is copied to a temp file that is renamed into
+// place, so a crash leaves either the full log or the trimmed one; both replay correctly.
+static bool wal_drop_prefix(off_t cut) {
+    struct stat st;
+    if (wal_fd < 0 || fstat(wal_fd, &st) != 0) return false;
+    if (cut >= st.st_size) {
+        return ftruncate(wal_fd, 0) == 0 && fsync(wal_fd) == 0;
+    }
+    string temp_path = string_concat(WAL_FILE, TEMP_FILE_SUFFIX);
+    if (temp_path == NULL) return false;
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    bool ok = fd >= 0;
+    char block[1 << 16];
+    for (off_t offset = cut; ok && offset < st.st_size; ) {
+        ssize_t n = pread(wal_fd, block, sizeof(block), offset);
+        struct iovec iov = { block, n > 0 ? (size_t)n : 0 };
+        ok = n > 0 && output_writev_all(fd, &iov, 1);
+        offset += n;
+    }
+    ok = ok && fsync(fd) == 0 && replace_file_durably(temp_path, WAL_FILE);
+    if (ok) {
+        close(wal_fd);
+        wal_fd = fd;
+    } else {
+        if (fd >= 0) close(fd);
+        remove(temp_path);
+    }
+    free(temp_path);
+    return ok;
+}
+
+// Writes a snapshot of the store and drops the log records it covers. Writers are held
+// up only while the log is flushed and the process forks; the snapshot itself is written
+// by the child from its frozen copy, and changes made meanwhile stay in the log.
+// checkpoint_lock is held from checkpoint_begin until checkpoint_finish.
+static void checkpoint_begin(Checkpoint *checkpoint) {
+    pthread_mutex_lock(&checkpoint_lock);
+    pthread_mutex_lock(&store_lock);
+    pthread_mutex_lock(&wal_io_lock);
+    bool flushed = wal_flush_locked();
+    struct stat st;
+    checkpoint->wal_cut = (wal_fd >= 0 && fstat(wal_fd, &st) == 0) ? st.st_size : 0;
+    pthread_mutex_lock(&wal_lock);
+    checkpoint->frozen_records = wal_records_since_checkpoint;
+    checkpoint->saved = false;
+    checkpoint->pid = flushed ? fork_frozen_save(write_snapshot, SNAPSHOT_FILE, &checkpoint->saved) : -1;
+    pthread_mutex_unlock(&wal_lock);
+    pthread_mutex_unlock(&wal_io_lock);
+    pthread_mutex_unlock(&store_lock);
+}
+
+static bool checkpoint_finish(Checkpoint *checkpoint, bool ok) {
+    if (ok) {
+        pthread_mutex_lock(&wal_io_lock);
+        if (!wal_drop_prefix(checkpoint->wal_cut)) {
+            fprintf(stderr, "Error: Could not truncate write-ahead log %s.\n", WAL_FILE);
+        }
+        pthread_mutex_unlock(&wal_io_lock);
+        pthread_mutex_lock(&wal_lock);
+        wal_records_since_checkpoint -= checkpoint->frozen_records;
+        pthread_mutex_unlock(&wal_lock);
+    }
+    pthread_mutex_unlock(&checkpoint_lock);
+    return ok;
+}
+
+// Reports a failed checkpoint, saying whether the changes it missed are safe in the log.
+void report_checkpoint_failure(const char *what) {
+    if (wal_unwritten()) {
+        fprintf(stderr, "Error: %s Recent changes could not be written to %s and are NOT saved.\n", what, WAL_FILE);
+    } else {
+        fprintf(stderr, "Error: %s Changes remain in %s.\n", what, WAL_FILE);
+    }
+}
+
+bool checkpoint_database(void) {
+    Checkpoint checkpoint;
+    checkpoint_begin(&checkpoint);
+    bool ok;
+    frozen_save_done(checkpoint.pid, checkpoint.saved, true, &ok);
+    return checkpoint_finish(&checkpoint, ok);
+}
+
+static long elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static long env_long(const char *name, long fallback) {
+    const char *value = getenv(name);
+    if (value == NULL) return fallback;
+    bool ok;
+    int parsed = string_n_to_int(value, strlen(value), &ok);
+    return ok && parsed >= 0 ? parsed : fallback;
+}
+
+// Caller holds wal_lock.
+static void wal_wait_ms(long ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&wal_wake, &wal_lock, &deadline);
+}
+
+// Coalesces bursts of changes: the first pending record starts a timer, and everything
+// logged until it expires (or until the buffer passes its size threshold) goes out in one
+// write and one fsync. Once WAL_CHECKPOINT_INTERVAL records have built up it checkpoints.
+// After a failed write it waits out a full window before trying again.
+static void *autosave_main(void *arg) {
+    (void)arg;
+    Checkpoint checkpoint;
+    bool checkpointing = false; // Log flushes carry on while the child writes the snapshot.
+    pthread_mutex_lock(&wal_lock);
+    while (!autosave.stop_requested) {
+        bool ok;
+        if (checkpointing && frozen_save_done(checkpoint.pid, checkpoint.saved, false, &ok)) {
+            checkpointing = false;
+            pthread_mutex_unlock(&wal_lock);
+            if (!checkpoint_finish(&checkpoint, ok)) report_checkpoint_failure("Checkpoint failed!");
+            pthread_mutex_lock(&wal_lock);
+        }
+        if (wal_pending_records == 0) {
+            if (checkpointing) wal_wait_ms(CHECKPOINT_POLL_MS);
+            else pthread_cond_wait(&wal_wake, &wal_lock);
+            continue;
+        }
+        bool checkpoint_due = !checkpointing && !wal_retry_pending &&
+                              wal_records_since_checkpoint >= WAL_CHECKPOINT_INTERVAL;
+        long remaining = autosave.interval_ms - elapsed_ms(&wal_first_pending);
+        if (!checkpoint_due && remaining > 0 &&
+            (wal_retry_pending || wal_pending.length < autosave.max_pending_bytes)) {
+            wal_wait_ms(checkpointing && remaining > CHECKPOINT_POLL_MS ? CHECKPOINT_POLL_MS : remaining);
+            continue;
+        }
+        pthread_mutex_unlock(&wal_lock);
+        if (checkpoint_due) {
+            checkpoint_begin(&checkpoint);
+            checkpointing = true;
+        } else {
+            wal_flush();
+        }
+        pthread_mutex_lock(&wal_lock);
+    }
+    pthread_mutex_unlock(&wal_lock);
+    if (checkpointing) {
+        bool ok;
+        frozen_save_done(checkpoint.pid, checkpoint.saved, true, &ok);
+        checkpoint_finish(&checkpoint, ok);
+    }
+    return NULL;
+}
+
+// Starts the autosave thread. STUDENTDB_AUTOSAVE_MS and STUDENTDB_AUTOSAVE_BYTES override
+// the defaults. If the thread cannot start, every change is written synchronously instead.
+bool autosave_start(void) {
+    autosave.interval_ms = env_long("STUDENTDB_AUTOSAVE_MS", AUTOSAVE_INTERVAL_MS);
+    autosave.max_pending_bytes = (size_t)env_long("STUDENTDB_AUTOSAVE_BYTES", AUTOSAVE_MAX_PENDING_BYTES);
+    autosave.stop_requested = false;
+    autosave.running = pthread_create(&autosave.thread, NULL, autosave_main, NULL) == 0;
+    if (!autosave.running) {
+        fprintf(stderr, "Warning: Could not start autosave thread. Changes will be saved synchronously.\n");
+    }
+    return autosave.running;
+}
+
+// Stops the thread after it finishes any write in progress. Changes still buffered stay
+// pending; the caller's final checkpoint writes them.
+void autosave_stop(void) {
+    if (!autosave.running) return;
+    pthread_mutex_lock(&wal_lock);
+    autosave.stop_requested = true;
+    pthread_cond_signal(&wal_wake);
+    pthread_mutex_unlock(&wal_lock);
+    pthread_join(autosave.thread, NULL);
+    autosave.running = false;
+}
+
+static size_t align8(size_t offset) {
+    return (offset + 7) & ~(size_t)7;
+}
+
+static void snapshot_layout(size_t n, size_t mark_cell_count, size_t symbol_count, size_t heap_size, SnapshotLayout *layout) {
+    layout->ids = align8(sizeof(SnapshotHeader));
+    layout->ages = align8(layout->ids + n * SNAPSHOT_ID_WIDTH);
+    layout->name_offsets = align8(layout->ages + n * sizeof(int32_t));
+    layout->majors = align8(layout->name_offsets + n * sizeof(uint32_t));
+    layout->mark_offsets = align8(layout->majors + n * sizeof(Symbol));
+    layout->mark_cells = align8(layout->mark_offsets + (n + 1) * sizeof(uint32_t));
+    layout->symbol_offsets = align8(layout->mark_cells + mark_cell_count * sizeof(uint32_t));
+    layout->heap = align8(layout->symbol_offsets + symbol_count * sizeof(uint32_t));
+    layout->total = layout->heap + heap_size;
+}
+
+static size_t heap_string_size(const char *str) {
+    return (str ? strlen(str) : 0) + 1;
+}
+
+static bool write_padding(OutputWriter *out, size_t target) {
+    static const char zeros[8] = { 0 };
+    return output_write(out, zeros, target - output_position(out));
+}
+
+static bool write_u32(OutputWriter *out, uint32_t value) {
+    return output_write(out, &value, sizeof(value));
+}
+
+static bool write_heap_string(OutputWriter *out, const char *str) {
+    return output_write(out, str ? str : "", heap_string_size(str));
+}
+
+// Writes the store as a versioned columnar snapshot. Through a SaveTarget it goes
+// to a temp file that is renamed into place, so a concurrent reader (or our own
+// mapping) never sees a half-written file.
+bool write_snapshot(SaveTarget *target) {
+    OutputWriter *out = &target->out;
+    // Tombstones are skipped, so the snapshot is always compact.
+    size_t n = (size_t)student_count();
+    size_t slots = (size_t)student_store.count;
+    size_t symbol_count = symbols.count > 0 ? symbols.count - 1 : 0;
+    size_t heap_size = 0;
+    size_t mark_cell_count = 0;
+    for (size_t i = 0; i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        heap_size += heap_string_size(student_name((int)i));
+        mark_cell_count += student_marks((int)i)->count;
+    }
+    for (size_t k = 1; k <= symbol_count; k++) heap_size += heap_string_size(symbols.names[k]);
+    if (heap_size > UINT32_MAX) {
+        save_error("Error: Snapshot string heap exceeds 4 GiB.", (const char *)NULL);
+        return false;
+    }
+    if (mark_cell_count > UINT32_MAX) {
+        save_error("Error: Snapshot mark cells exceed the 32-bit offset range.", (const char *)NULL);
+        return false;
+    }
+    SnapshotLayout layout;
+    snapshot_layout(n, mark_cell_count, symbol_count, heap_size, &layout);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.id_width = SNAPSHOT_ID_WIDTH;
+    header.symbol_count = (uint32_t)symbol_count;
+    header.record_count = n;
+    header.mark_cell_count = mark_cell_count;
+    header.heap_size = heap_size;
+    bool ok = output_write(out, &header, sizeof(header));
+
+    ok = ok && write_padding(out, layout.ids);
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        char id_cell[SNAPSHOT_ID_WIDTH] = { 0 };
+        const char *id = student_id((int)i);
+        memcpy(id_cell, id, strlen(id));
+        ok = output_write(out, id_cell, sizeof(id_cell));
+    }
+    ok = ok && write_padding(out, layout.ages);
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        int32_t age = student_age((int)i);
+        ok = output_write(out, &age, sizeof(age));
+    }
+    ok = ok && write_padding(out, layout.name_offsets);
+    uint32_t heap_cursor = 0;
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        ok = write_u32(out, heap_cursor);
+        heap_cursor += (uint32_t)heap_string_size(student_name((int)i));
+    }
+    ok = ok && write_padding(out, layout.majors);
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        ok = write_u32(out, student_major((int)i));
+    }
+    ok = ok && write_padding(out, layout.mark_offsets);
+    uint32_t cell_cursor = 0;
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        ok = write_u32(out, cell_cursor);
+        cell_cursor += student_marks((int)i)->count;
+    }
+    ok = ok && write_u32(out, cell_cursor);
+    ok = ok && write_padding(out, layout.mark_cells);
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        const MarkList *marks = student_marks((int)i);
+        for (uint32_t c = 0; ok && c < marks->count; c++) {
+            ok = write_u32(out, marks->cells[c].value | (uint32_t)marks->cells[c].mark << SYMBOL_BITS);
+        }
+    }
+    ok = ok && write_padding(out, layout.symbol_offsets);
+    for (size_t k = 1; ok && k <= symbol_count; k++) {
+        ok = write_u32(out, heap_cursor);
+        heap_cursor += (uint32_t)heap_string_size(symbols.names[k]);
+    }
+    ok = ok && write_padding(out, layout.heap);
+    for (size_t i = 0; ok && i < slots; i++) {
+        if (!student_is_live((int)i)) continue;
+        ok = write_heap_string(out, student_name((int)i));
+    }
+    for (size_t k = 1; ok && k <= symbol_count; k++) ok = write_heap_string(out, symbols.names[k]);
+    return ok;
+}
+
+static bool snapshot_header_valid(const SnapshotHeader *header, size_t file_size) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) return false;
+    if (header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER) return false;
+    if (header->id_width != SNAPSHOT_ID_WIDTH || header->record_count > INT32_MAX) return false;
+    if (header->heap_size == 0 && (header->record_count > 0 || header->symbol_count > 0)) return false;
+    if (header->mark_cell_count > UINT32_MAX) return false;
+    SnapshotLayout layout;
+    snapshot_layout((size_t)header->record_count, (size_t)header->mark_cell_count, header->symbol_count,
+                    (size_t)header->heap_size, &layout);
+    return layout.total == file_size;
+}
+
+// Validates the cells [begin, end) of one snapshot record and copies them, with
+// subjects renumbered through `remap`, into a list allocated from record_heap.
+static bool snapshot_marks_decode(const uint32_t *packed, uint32_t begin, uint32_t end, uint64_t total,
+                                  const Symbol *remap, size_t symbol_count, MarkList *out) {
+    out->cells = NULL;
+    out->count = 0;
+    if (begin > end || end > total) return false;
+    if (begin == end) return true;
+    MarkCell *cells = arena_alloc(&record_heap, (end - begin) * sizeof(MarkCell));
+    if (cells == NULL) return false;
+    uint32_t semester = 0;
+    bool ok = true;
+    for (uint32_t c = begin; ok && c < end; c++) {
+        uint32_t value = packed[c] & SYMBOL_MAX;
+        uint32_t mark = packed[c] >> SYMBOL_BITS;
+        if (mark == MARK_SEMESTER_HEADER) {
+            ok = value > semester && value <= MARKS_LIMIT_CEILING;
+            semester = value;
+            cells[c - begin] = mark_header_cell((int)value);
+        } else {
+            ok = semester > 0 && value != SYMBOL_NONE && value <= symbol_count && mark <= MAX_MARK;
+            if (ok) cells[c - begin] = mark_subject_cell(remap[value], (int)mark);
+        }
+    }
+    if (!ok) {
+        arena_free(&record_heap, cells, (end - begin) * sizeof(MarkCell));
+        return false;
+    }
+    out->cells = cells;
+    out->count = end - begin;
+    return true;
+}
+
+// Drops everything load_snapshot() put in the store, and the mapping it points into.
+static void snapshot_unload(void) {
+    free_all_student_memory();
+    munmap(snapshot_map.base, snapshot_map.length);
+    snapshot_map.base = NULL;
+    snapshot_map.length = 0;
+}
+
+// Maps the snapshot and fixes up each record's pointers into the mapping: no
+// field is parsed, and only the symbol strings and mark cells are copied.
+// Returns false, leaving the store empty, if the file is missing, was written by
+// an incompatible build, fails validation, or its ordered ID index cannot be built.
+// IDs get the same checks as a CSV row, and a bad or repeated one fails the whole
+// file: the ID index cannot hold a repeat.
+bool load_snapshot(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) { close(fd); return false; }
+    size_t length = (size_t)st.st_size;
+    void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const SnapshotHeader *header = base;
+    if (!snapshot_header_valid(header, length)) {
+        fprintf(stderr, "Warning: %s is not a compatible snapshot. Ignoring it.\n", filename);
+        munmap(base, length);
+        return false;
+    }
+    size_t n = (size_t)header->record_count;
+    size_t symbol_count = header->symbol_count;
+    SnapshotLayout layout;
+    snapshot_layout(n, (size_t)header->mark_cell_count, symbol_count, (size_t)header->heap_size, &layout);
+    const char *bytes = base;
+    const char *heap = bytes + layout.heap;
+    if (header->heap_size > 0 && heap[header->heap_size - 1] != '\0') {
+        fprintf(stderr, "Warning: %s has a corrupt string heap. Ignoring it.\n", filename);
+        munmap(base, length);
+        return false;
+    }
+    const int32_t *ages = (const int32_t *)(bytes + layout.ages);
+    const uint32_t *name_offsets = (const uint32_t *)(bytes + layout.name_offsets);
+    const Symbol *majors = (const Symbol *)(bytes + layout.majors);
+    const uint32_t *mark_offsets = (const uint32_t *)(bytes + layout.mark_offsets);
+    const uint32_t *mark_cells = (const uint32_t *)(bytes + layout.mark_cells);
+    const uint32_t *symbol_offsets = (const uint32_t *)(bytes + layout.symbol_offsets);
+
+    // Snapshot symbols are renumbered through the live table, which may already hold some.
+    Symbol *remap = malloc((symbol_count + 1) * sizeof(Symbol));
+    bool symbols_ok = remap != NULL;
+    if (remap) remap[SYMBOL_NONE] = SYMBOL_NONE;
+    for (size_t k = 0; symbols_ok && k < symbol_count; k++) {
+        symbols_ok = symbol_offsets[k] < header->heap_size &&
+                     (remap[k + 1] = symbol_intern(heap + symbol_offsets[k])) != SYMBOL_NONE;
+    }
+    if (!symbols_ok) {
+        fprintf(stderr, "Warning: %s has a corrupt symbol table. Ignoring it.\n", filename);
+        free(remap);
+        munmap(base, length);
+        return false;
+    }
+
+    free_all_student_memory();
+    snapshot_map.base = base;
+    snapshot_map.length = length;
+    id_order.deferred = true;
+    mark_index.deferred = true;
+
+    for (size_t i = 0; i < n; i++) {
+        Student s;
+        initialize_student_marks(&s);
+        const char *id = bytes + layout.ids + i * SNAPSHOT_ID_WIDTH;
+        if (!student_id_valid(id, strnlen(id, SNAPSHOT_ID_WIDTH)) || find_student_by_id((const string)id) != -1) {
+            fprintf(stderr, "Warning: %s has an invalid or duplicate ID in record %zu. Ignoring it.\n", filename, i);
+            free(remap);
+            snapshot_unload();
+            return false;
+        }
+        if (name_offsets[i] >= header->heap_size || majors[i] > symbol_count ||
+            ages[i] <= 0 || ages[i] > MAX_AGE) {
+            fprintf(stderr, "Warning: Corrupt snapshot record %zu. Skipping.\n", i);
+            continue;
+        }
+        memcpy(s.id, id, SNAPSHOT_ID_WIDTH);
+        // Long names keep pointing into the mapping, so the load allocates nothing.
+        const char *name = heap + name_offsets[i];
+        small_name_set(&s.name, name, strlen(name), NULL);
+        s.age = (uint8_t)ages[i];
+        s.major = remap[majors[i]];
+        bool record_ok = snapshot_marks_decode(mark_cells, mark_offsets[i], mark_offsets[i + 1],
+                                               header->mark_cell_count, remap, symbol_count, &s.marks);
+        if (!record_ok) {
+            fprintf(stderr, "Warning: Corrupt snapshot record %zu. Skipping.\n", i);
+            mark_list_release(&s.marks);
+            continue;
+        }
+        bool stored = store_append(&s);
+        if (!stored || !index_student(student_store.count - 1)) {
+            fprintf(stderr, "Memory error: could not grow student store. Stopping snapshot load at record %zu.\n", i);
+            if (stored) student_store.count--;
+            break;
+        }
+    }
+    free(remap);
+    if (!mark_index_build()) fprintf(stderr, "Memory error: mark index may be incomplete.\n");
+    if (!id_order_build()) {
+        fprintf(stderr, "Memory error: could not build ordered ID index. Ignoring %s.\n", filename);
+        snapshot_unload(); // The caller falls back to the CSV with an empty store.
+        return false;
+    }
+    return true;
+}
+
+static bool snapshot_owns(const char *p) {
+    const char *base = snapshot_map.base;
+    return base != NULL && p >= base && p < base + snapshot_map.length;
+}
+
+// Returns a record's string to record_heap for reuse, unless it points into the mapped snapshot.
+void release_record_string(string s) {
+    if (s != NULL && !snapshot_owns(s)) arena_free(&record_heap, s, strlen(s) + 1);
+}
+
+// Stores `length` bytes of `text` inline if they fit. Otherwise copies them into
+// `strings`, or, when `strings` is NULL, points at `text` itself, which must
+// outlive the name. Returns false only if the copy cannot be allocated.
+bool small_name_set(SmallName *name, const char *text, size_t length, arena *strings) {
+    memset(name->text, 0, sizeof(name->text));
+    if (length <= NAME_INLINE_LENGTH) {
+        memcpy(name->text, text, length);
+        return true;
+    }
+    const char *heap = strings ? arena_copy_n(strings, text, length) : text;
+    if (heap == NULL) return false;
+    memcpy(name->text, &heap, sizeof(heap));
+    name->text[NAME_INLINE_LENGTH] = NAME_SPILLED;
+    return true;
+}
+
+const char *small_name_text(const SmallName *name) {
+    if (name->text[NAME_INLINE_LENGTH] != NAME_SPILLED) return name->text;
+    const char *heap;
+    memcpy(&heap, name->text, sizeof(heap));
+    return heap;
+}
+
+// Returns a spilled name to record_heap and leaves `name` empty.
+void small_name_release(SmallName *name) {
+    if (name->text[NAME_INLINE_LENGTH] == NAME_SPILLED) release_record_string((string)small_name_text(name));
+    memset(name->text, 0, sizeof(name->text));
+}
+
+void free_student_record(Student *s) {
+    s->id[0] = '\0';
+    small_name_release(&s->name);
+    s->major = SYMBOL_NONE;
+    free_student_marks_memory(s);
+}
+
+void free_student_marks_memory(Student *s) {
+    mark_list_release(&s->marks);
+}
+
+// Reads the input limits once at startup. Out-of-range values keep the defaults.
+void load_marks_limits(void) {
+    long semesters = env_long("STUDENTDB_MAX_SEMESTERS", DEFAULT_MAX_SEMESTERS);
+    long subjects = env_long("STUDENTDB_MAX_SUBJECTS", DEFAULT_MAX_SUBJECTS_PER_SEMESTER);
+    if (semesters >= 1 && semesters <= MARKS_LIMIT_CEILING) marks_limits.max_semesters = (int)semesters;
+    if (subjects >= 1 && subjects <= MARKS_LIMIT_CEILING) marks_limits.max_subjects_per_semester = (int)subjects;
+}
+
+MarkCell mark_header_cell(int semester) {
+    return (MarkCell){ (uint32_t)semester, MARK_SEMESTER_HEADER };
+}
+
+MarkCell mark_subject_cell(Symbol subject, int mark) {
+    return (MarkCell){ subject, (uint32_t)mark };
+}
+
+bool mark_cell_is_header(MarkCell cell) {
+    return cell.mark == MARK_SEMESTER_HEADER;
+}
+
+// Returns the position just past the semester whose header is at `header`.
+uint32_t mark_list_semester_end(const MarkList *list, uint32_t header) {
+    uint32_t end = header + 1;
+    while (end < list->count && !mark_cell_is_header(list->cells[end])) end++;
+    return end;
+}
+
+// O(cells). Sets [*begin, *end) to the subjects of `semester` and returns true
+// if it is active; otherwise returns false with *begin where its header belongs.
+bool mark_list_find_semester(const MarkList *list, int semester, uint32_t *begin, uint32_t *end) {
+    uint32_t header = 0;
+    while (header < list->count && (int)list->cells[header].value < semester) {
+        header = mark_list_semester_end(list, header);
+    }
+    if (header < list->count && (int)list->cells[header].value == semester) {
+        *begin = header + 1;
+        *end = mark_list_semester_end(list, header);
+        return true;
+    }
+    *begin = *end = header;
+    return false;
+}
+
+// Sets `*mark` to the student's mark in `subject` that semester; false if there is none.
+bool mark_list_find_mark(const MarkList *list, int semester, Symbol subject, int *mark) {
+    uint32_t begin, end;
+    if (!mark_list_find_semester(list, semester, &begin, &end)) return false;
+    for (uint32_t i = begin; i < end; i++) {
+        if (list->cells[i].value == subject) {
+            *mark = (int)list->cells[i].mark;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t mark_list_subject_count(const MarkList *list) {
+    uint32_t subjects = 0;
+    for (uint32_t i = 0; i < list->count; i++) subjects += !mark_cell_is_header(list->cells[i]);
+    return subjects;
+}
+
+// Copies `count` cells into a new list allocated from `heap`; an empty list allocates nothing.
+bool mark_list_copy(const MarkCell *cells, uint32_t count, arena *heap, MarkList *out) {
+    out->cells = NULL;
+    out->count = 0;
+    if (count == 0) return true;
+    MarkCell *copy = arena_alloc(heap, count * sizeof(MarkCell));
+    if (copy == NULL) return false;
+    memcpy(copy, cells, count * sizeof(MarkCell));
+    out->cells = copy;
+    out->count = count;
+    return true;
+}
+
+// Builds in `out`, from record_heap, a copy of `list` with `n` cells inserted at
+// `at`. `list` itself is untouched; release it once nothing refers to it.
+bool mark_list_insert(const MarkList *list, uint32_t at, const MarkCell *cells, uint32_t n, MarkList *out) {
+    MarkCell *copy = arena_alloc(&record_heap, (list->count + n) * sizeof(MarkCell));
+    if (copy == NULL) return false;
+    if (at > 0) memcpy(copy, list->cells, at * sizeof(MarkCell));
+    memcpy(copy + at, cells, n * sizeof(MarkCell));
+    if (list->count > at) memcpy(copy + at + n, list->cells + at, (list->count - at) * sizeof(MarkCell));
+    out->cells = copy;
+    out->count = list->count + n;
+    return true;
+}
+
+// Returns the cells to record_heap and leaves `list` empty.
+void mark_list_release(MarkList *list) {
+    if (list->cells != NULL) arena_free(&record_heap, list->cells, list->count * sizeof(MarkCell));
+    list->cells = NULL;
+    list->count = 0;
+}
+
+// Builds in `out`, from record_heap, `base` with `delta` applied: a subject in
+// `delta` replaces the mark of the same subject in that semester of `base` or is
+// appended to it, and semesters missing from `base` are added. Fails without
+// allocating if a semester would exceed the subject limit, or a new semester is past
+// the semester limit, reporting it in `*over_limit` as for mark_list_over_limit()
+// (0 when out of memory).
+bool mark_list_merge(const MarkList *base, const MarkList *delta, MarkList *out, int *over_limit) {
+    MarkBuilder builder = { NULL, 0, 0 };
+    bool ok = true;
+    *over_limit = 0;
+    uint32_t i = 0, j = 0;
+    while (ok && (i < base->count || j < delta->count)) {
+        uint32_t base_semester = i < base->count ? base->cells[i].value : UINT32_MAX;
+        uint32_t delta_semester = j < delta->count ? delta->cells[j].value : UINT32_MAX;
+        uint32_t base_end = i < base->count ? mark_list_semester_end(base, i) : i;
+        uint32_t delta_end = j < delta->count ? mark_list_semester_end(delta, j) : j;
+        if (base_semester < delta_semester) {
+            for (uint32_t c = i; ok && c < base_end; c++) ok = mark_builder_push(&builder, base->cells[c]);
+            i = base_end;
+            continue;
+        }
+        if (base_semester != delta_semester && delta_semester > (uint32_t)marks_limits.max_semesters) {
+            *over_limit = -(int)delta_semester;
+            ok = false;
+            break;
+        }
+        uint32_t header = builder.count;
+        uint32_t limit = (uint32_t)marks_limits.max_subjects_per_semester;
+        ok = mark_builder_push(&builder, delta->cells[j]);
+        if (base_semester == delta_semester) {
+            for (uint32_t c = i + 1; ok && c < base_end; c++) ok = mark_builder_push(&builder, base->cells[c]);
+            // A semester stored under a higher limit may keep its size, but not grow.
+            if (base_end - i - 1 > limit) limit = base_end - i - 1;
+            i = base_end;
+        }
+        for (uint32_t d = j + 1; ok && d < delta_end; d++) {
+            uint32_t c = header + 1;
+            while (c < builder.count && builder.cells[c].value != delta->cells[d].value) c++;
+            if (c < builder.count) builder.cells[c].mark = delta->cells[d].mark;
+            else ok = mark_builder_push(&builder, delta->cells[d]);
+        }
+        j = delta_end;
+        if (ok && builder.count - header - 1 > limit) {
+            *over_limit = (int)delta_semester;
+            ok = false;
+        }
+    }
+    ok = ok && mark_list_copy(builder.cells, builder.count, &record_heap, out);
+    free(builder.cells);
+    return ok;
+}
+
+// Checks new input against marks_limits. Returns 0 if `list` fits, the semester
+// number if that semester has too many subjects, or minus the semester number if
+// it is past the semester limit.
+int mark_list_over_limit(const MarkList *list) {
+    for (uint32_t h = 0; h < list->count; h = mark_list_semester_end(list, h)) {
+        int semester = (int)list->cells[h].value;
+        if (semester > marks_limits.max_semesters) return -semester;
+        if (mark_list_semester_end(list, h) - h - 1 > (uint32_t)marks_limits.max_subjects_per_semester) return semester;
+    }
+    return 0;
+}
+
+// Describes a nonzero mark_list_over_limit() result.
+void mark_limit_reason(int over_limit, char *reason, size_t size) {
+    if (over_limit < 0) snprintf(reason, size, "semester %d is past the limit of %d", -over_limit, marks_limits.max_semesters);
+    else snprintf(reason, size, "too many subjects in semester %d", over_limit);
+}
+
+bool mark_builder_push(MarkBuilder *builder, MarkCell cell) {
+    if (builder->count == builder->capacity) {
+        uint32_t new_capacity = builder->capacity == 0 ? 16 : builder->capacity * 2;
+        MarkCell *temp = realloc(builder->cells, new_capacity * sizeof(MarkCell));
+        if (temp == NULL) return false;
+        builder->cells = temp;
+        builder->capacity = new_capacity;
+    }
+    builder->cells[builder->count++] = cell;
+    return true;
+}
+
+// O(arena blocks): record strings are dropped with their arena, not one by one.
+void free_all_student_memory(void) {
+    student_store.count = 0;
+    student_store.tombstones = 0;
+    clear_student_indexes();
+    arena_release(&record_heap);
+}
+
+static StudentChunk *student_chunk(int index) {
+    return student_store.chunks[index >> STUDENT_CHUNK_SHIFT];
+}
+
+static int student_slot(int index) {
+    return index & (STUDENT_CHUNK_SIZE - 1);
+}
+
+// Column accessors: O(1), and each reads only its own column.
+const char *student_id(int index) {
+    return student_chunk(index)->ids[student_slot(index)];
+}
+
+const char *student_name(int index) {
+    return small_name_text(&student_chunk(index)->names[student_slot(index)]);
+}
+
+int student_age(int index) {
+    return student_chunk(index)->ages[student_slot(index)];
+}
+
+Symbol student_major(int index) {
+    return student_chunk(index)->majors[student_slot(index)];
+}
+
+const MarkList *student_marks(int index) {
+    return &student_chunk(index)->marks[student_slot(index)];
+}
+
+// False for a deleted record awaiting compaction. Reads only the age column.
+bool student_is_live(int index) {
+    return student_chunk(index)->ages[student_slot(index)] != 0;
+}
+
+int student_count(void) {
+    return student_store.count - student_store.tombstones;
+}
+
+// Gathers the record at `index` into a row. The row shares the record's name and
+// mark cells, so it must not outlive the record or be freed with free_student_record().
+void student_load(int index, Student *out) {
+    StudentChunk *chunk = student_chunk(index);
+    int slot = student_slot(index);
+    memcpy(out->id, chunk->ids[slot], sizeof(out->id));
+    out->name = chunk->names[slot];
+    out->age = chunk->ages[slot];
+    out->major = chunk->majors[slot];
+    out->marks = chunk->marks[slot];
+}
+
+// Scatters `s` into the columns at `index`; the record takes over s's name and marks.
+void student_store_at(int index, const Student *s) {
+    StudentChunk *chunk = student_chunk(index);
+    int slot = student_slot(index);
+    memcpy(chunk->ids[slot], s->id, sizeof(chunk->ids[slot]));
+    chunk->names[slot] = s->name;
+    chunk->ages[slot] = s->age;
+    chunk->majors[slot] = s->major;
+    chunk->marks[slot] = s->marks;
+}
+
+// Frees the stored record's name and marks. Call before the record is overwritten;
+// store_remove_at() does its own releasing.
+void student_release_at(int index) {
+    small_name_release(&student_chunk(index)->names[student_slot(index)]);
+    mark_list_release(&student_chunk(index)->marks[student_slot(index)]);
+}
+
+// Amortized O(1): a new chunk is allocated only every STUDENT_CHUNK_SIZE records,
+// and growing the chunk table copies pointers, never the records themselves.
+bool store_append(const Student *s) {
+    size_t chunk_idx = (size_t)student_store.count >> STUDENT_CHUNK_SHIFT;
+    if (chunk_idx == student_store.chunk_count) {
+        if (student_store.chunk_count == student_store.chunk_capacity) {
+            size_t new_capacity = student_store.chunk_capacity == 0 ? 8 : student_store.chunk_capacity * 2;
+            StudentChunk **temp = realloc(student_store.chunks, new_capacity * sizeof(StudentChunk*));
+            if (!temp) return false;
+            student_store.chunks = temp;
+            student_store.chunk_capacity = new_capacity;
+        }
+        StudentChunk *chunk = malloc(sizeof(StudentChunk));
+        if (!chunk) return false;
+        student_store.chunks[student_store.chunk_count++] = chunk;
+    }
+    student_store_at(student_store.count, s);
+    student_store.count++;
+    return true;
+}
+
+// O(1) plus one bounded compaction step: the record becomes a tombstone in
+// place, so no other record moves and no sorted index is touched. Its ID order
+// entry and mark postings are left for the compaction round to drop; readers
+// skip them with student_is_live(). The ID and marks stay until then so the
+// round can still find those entries.
+void store_remove_at(int index) {
+    id_index_remove(student_id(index));
+    small_name_release(&student_chunk(index)->names[student_slot(index)]);
+    student_chunk(index)->ages[student_slot(index)] = 0;
+    student_store.tombstones++;
+    store_compact_step(STORE_COMPACT_STEP);
+}
+
+void store_release(void) {
+    free_all_student_memory();
+    for (size_t i = 0; i < student_store.chunk_count; i++) {
+        free(student_store.chunks[i]);
+    }
+    free(student_store.chunks);
+    student_store.chunks = NULL;
+    student_store.chunk_count = 0;
+    student_store.chunk_capacity = 0;
+    free(id_index.slots);
+    id_index.slots = NULL;
+    id_index.capacity = 0;
+    free(id_order.entries);
+    id_order.entries = NULL;
+    id_order.capacity = 0;
+    mark_index_release();
+    symbol_table_release();
+    if (snapshot_map.base) munmap(snapshot_map.base, snapshot_map.length);
+    snapshot_map.base = NULL;
+    snapshot_map.length = 0;
+}
+
+// Adds the record at `index` to every secondary index. Call after store_append.
+bool index_student(int index) {
+    if (!id_index_insert(index)) return false;
+    if (!id_order_insert(index)) {
+        id_index_remove(student_id(index));
+        return false;
+    }
+    if (!index_student_marks(index)) {
+        id_index_remove(student_id(index));
+        id_order_remove(index);
+        return false;
+    }
+    return true;
+}
+
+// Removes the record at `index` from every secondary index. Call while its fields are still valid.
+void unindex_student(int index) {
+    id_index_remove(student_id(index));
+    id_order_remove(index);
+    unindex_student_marks(index);
+}
+
+// Adds one posting per subject cell of the record at `index`. On failure removes
+// the ones it added, leaving mark_index as it was.
+bool index_student_marks(int index) {
+    const MarkList *marks = student_marks(index);
+    int semester = 0;
+    for (uint32_t i = 0; i < marks->count; i++) {
+        if (mark_cell_is_header(marks->cells[i])) {
+            semester = (int)marks->cells[i].value;
+        } else if (!mark_index_add(semester, marks->cells[i].value, marks->cells[i].mark, index)) {
+            unindex_student_marks(index);
+            return false;
+        }
+    }
+    return true;
+}
+
+void unindex_student_marks(int index) {
+    const MarkList *marks = student_marks(index);
+    int semester = 0;
+    for (uint32_t i = 0; i < marks->count; i++) {
+        if (mark_cell_is_header(marks->cells[i])) semester = (int)marks->cells[i].value;
+        else mark_index_remove(semester, marks->cells[i].value, marks->cells[i].mark, index);
+    }
+}
+
+void clear_student_indexes(void) {
+    store_compact_abort();
+    for (size_t i = 0; i < id_index.capacity; i++) id_index.slots[i] = ID_INDEX_EMPTY;
+    id_index.size = 0;
+    id_order.size = 0;
+    for (size_t l = 0; l < mark_index.list_count; l++) mark_index.lists[l].size = 0;
+}
+
+// FNV-1a.
+static size_t hash_string(const char *str) {
+    size_t h = (size_t)14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        h ^= *p;
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+// Returns the slot holding `id`, or the empty slot where it would go.
+static size_t id_index_probe(const char *id) {
+    size_t mask = id_index.capacity - 1;
+    size_t slot = hash_string(id) & mask;
+    while (id_index.slots[slot] != ID_INDEX_EMPTY) {
+        if (strcmp(student_id(id_index.slots[slot]), id) == 0) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool id_index_rehash(size_t new_capacity) {
+    int *old_slots = id_index.slots;
+    size_t old_capacity = id_index.capacity;
+    int *new_slots = malloc(new_capacity * sizeof(int));
+    if (!new_slots) return false;
+    for (size_t i = 0; i < new_capacity; i++) new_slots[i] = ID_INDEX_EMPTY;
+    id_index.slots = new_slots;
+    id_index.capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] != ID_INDEX_EMPTY) {
+            id_index.slots[id_index_probe(student_id(old_slots[i]))] = old_slots[i];
+        }
+    }
+    free(old_slots);
+    return true;
+}
+
+static bool id_index_grow(void) {
+    return id_index_rehash(id_index.capacity == 0 ? ID_INDEX_MIN_CAPACITY : id_index.capacity * 2);
+}
+
+// Sizes the table for `records` entries up front so a bulk load never rehashes.
+bool id_index_reserve(size_t records) {
+    size_t capacity = id_index.capacity == 0 ? ID_INDEX_MIN_CAPACITY : id_index.capacity;
+    while (capacity < records * 2) capacity *= 2;
+    return capacity == id_index.capacity || id_index_rehash(capacity);
+}
+
+// O(1) expected.
+int id_index_lookup(const char *id) {
+    if (id_index.size == 0) return -1;
+    return id_index.slots[id_index_probe(id)];
+}
+
+// O(1) amortized. The record at `index` must already be in the store with a unique ID.
+bool id_index_insert(int index) {
+    if ((id_index.size + 1) * 2 > id_index.capacity && !id_index_grow()) return false;
+    id_index.slots[id_index_probe(student_id(index))] = index;
+    id_index.size++;
+    return true;
+}
+
+// O(1) expected. Uses backward-shift deletion so no tombstones are left in the probe chains.
+void id_index_remove(const char *id) {
+    if (id_index.size == 0) return;
+    size_t mask = id_index.capacity - 1;
+    size_t hole = id_index_probe(id);
+    if (id_index.slots[hole] == ID_INDEX_EMPTY) return;
+    id_index.slots[hole] = ID_INDEX_EMPTY;
+    id_index.size--;
+    for (size_t next = (hole + 1) & mask; id_index.slots[next] != ID_INDEX_EMPTY; next = (next + 1) & mask) {
+        size_t home = hash_string(student_id(id_index.slots[next])) & mask;
+        // Move the entry into the hole unless its home lies cyclically in (hole, next].
+        bool home_in_range = (hole < next) ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!home_in_range) {
+            id_index.slots[hole] = id_index.slots[next];
+            id_index.slots[next] = ID_INDEX_EMPTY;
+            hole = next;
+        }
+    }
+}
+
+// First position in `entries` (sorted like id_order) whose ID compares >= key over
+// its first `key_len` characters (> key when `upper` is set). Pass strlen + 1 to
+// compare whole IDs.
+static size_t id_lower_bound(const int *entries, size_t size, const char *key, size_t key_len, bool upper) {
+    size_t lo = 0, hi = size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(student_id(entries[mid]), key, key_len);
+        if (cmp < 0 || (upper && cmp == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static size_t id_order_lower_bound(const char *key, size_t key_len, bool upper) {
+    return id_lower_bound(id_order.entries, id_order.size, key, key_len, upper);
+}
+
+// Position of record `index` in `entries`, or `size`. Tombstones keep their ID,
+// so a re-added ID can appear more than once; only one entry holds `index`.
+static size_t id_entry_find(const int *entries, size_t size, int index) {
+    const char *id = student_id(index);
+    for (size_t pos = id_lower_bound(entries, size, id, strlen(id) + 1, false); pos < size; pos++) {
+        if (entries[pos] == index) return pos;
+        if (strcmp(student_id(entries[pos]), id) != 0) break;
+    }
+    return size;
+}
+
+static bool id_order_reserve(size_t needed) {
+    if (needed <= id_order.capacity) return true;
+    size_t new_capacity = id_order.capacity == 0 ? 64 : id_order.capacity;
+    while (new_capacity < needed) new_capacity *= 2;
+    int *temp = realloc(id_order.entries, new_capacity * sizeof(int));
+    if (!temp) return false;
+    id_order.entries = temp;
+    id_order.capacity = new_capacity;
+    return true;
+}
+
+// O(log n) search plus a memmove; appending an ID larger than all others is O(1).
+bool id_order_insert(int index) {
+    if (id_order.deferred) return true;
+    if (!id_order_reserve(id_order.size + 1)) return false;
+    const char *id = student_id(index);
+    size_t pos = id_order_lower_bound(id, strlen(id) + 1, false);
+    memmove(&id_order.entries[pos + 1], &id_order.entries[pos], (id_order.size - pos) * sizeof(int));
+    id_order.entries[pos] = index;
+    id_order.size++;
+    store_compact_order_inserted(pos, index);
+    return true;
+}
+
+void id_order_remove(int index) {
+    if (id_order.deferred) return;
+    size_t pos = id_entry_find(id_order.entries, id_order.size, index);
+    if (pos == id_order.size) return;
+    store_compact_order_removed(pos, index);
+    memmove(&id_order.entries[pos], &id_order.entries[pos + 1], (id_order.size - pos - 1) * sizeof(int));
+    id_order.size--;
+}
+
+static int compare_indices_by_id(const void *a, const void *b) {
+    return strcmp(student_id(*(const int *)a), student_id(*(const int *)b));
+}
+
+// One O(n log n) sort after bulk work instead of a memmove per changed row.
+// Drops the entries of deleted records, so it ends any compaction round.
+bool id_order_build(void) {
+    store_compact_abort();
+    if (!id_order_reserve((size_t)student_store.count)) return false;
+    id_order.deferred = false;
+    id_order.size = 0;
+    for (int i = 0; i < student_store.count; i++) {
+        if (student_is_live(i)) id_order.entries[id_order.size++] = i;
+    }
+    if (id_order.size > 1) qsort(id_order.entries, id_order.size, sizeof(int), compare_indices_by_id);
+    return true;
+}
+
+// Returns how many IDs start with `prefix` and stores the position of the first in `*first`.
+size_t id_order_prefix_range(const char *prefix, size_t *first) {
+    size_t len = strlen(prefix);
+    *first = id_order_lower_bound(prefix, len, false);
+    return id_order_lower_bound(prefix, len, true) - *first;
+}
+
+// First position in id_order whose ID is >= id (> id when `after` is set).
+size_t id_order_position(const char *id, bool after) {
+    return id_order_lower_bound(id, strlen(id) + 1, after);
+}
+
+static size_t mark_key_hash(int semester_number, Symbol subject) {
+    return ((size_t)subject * (size_t)0x9E3779B97F4A7C15ULL) ^ (size_t)semester_number;
+}
+
+// Returns the slot holding the key, or the empty slot where it would go.
+static size_t mark_index_probe(int semester_number, Symbol subject) {
+    size_t mask = mark_index.slot_capacity - 1;
+    size_t slot = mark_key_hash(semester_number, subject) & mask;
+    while (mark_index.slots[slot] != ID_INDEX_EMPTY) {
+        const PostingList *list = &mark_index.lists[mark_index.slots[slot]];
+        if (list->semester_number == semester_number && list->subject == subject) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool mark_index_grow_slots(void) {
+    size_t new_capacity = mark_index.slot_capacity == 0 ? ID_INDEX_MIN_CAPACITY : mark_index.slot_capacity * 2;
+    int *new_slots = malloc(new_capacity * sizeof(int));
+    if (!new_slots) return false;
+    for (size_t i = 0; i < new_capacity; i++) new_slots[i] = ID_INDEX_EMPTY;
+    free(mark_index.slots);
+    mark_index.slots = new_slots;
+    mark_index.slot_capacity = new_capacity;
+    for (size_t l = 0; l < mark_index.list_count; l++) {
+        const PostingList *list = &mark_index.lists[l];
+        mark_index.slots[mark_index_probe(list->semester_number, list->subject)] = (int)l;
+    }
+    return true;
+}
+
+// O(1) expected. Returns NULL if no record ever had this subject in this semester.
+PostingList *mark_index_find(int semester_number, Symbol subject) {
+    if (mark_index.list_count == 0) return NULL;
+    int slot_value = mark_index.slots[mark_index_probe(semester_number, subject)];
+    return slot_value == ID_INDEX_EMPTY ? NULL : &mark_index.lists[slot_value];
+}
+
+static PostingList *mark_index_find_or_create(int semester_number, Symbol subject) {
+    PostingList *list = mark_index_find(semester_number, subject);
+    if (list) return list;
+    if ((mark_index.list_count + 1) * 2 > mark_index.slot_capacity && !mark_index_grow_slots()) return NULL;
+    if (mark_index.list_count == mark_index.list_capacity) {
+        size_t new_capacity = mark_index.list_capacity == 0 ? 16 : mark_index.list_capacity * 2;
+        PostingList *temp = realloc(mark_index.lists, new_capacity * sizeof(PostingList));
+        if (!temp) return NULL;
+        mark_index.lists = temp;
+        mark_index.list_capacity = new_capacity;
+    }
+    list = &mark_index.lists[mark_index.list_count];
+    list->semester_number = semester_number;
+    list->subject = subject;
+    list->postings = NULL;
+    list->size = 0;
+    list->capacity = 0;
+    mark_index.slots[mark_index_probe(semester_number, subject)] = (int)mark_index.list_count;
+    mark_index.list_count++;
+    return list;
+}
 
-        size_t num_tokens;
-        string *tokens = string_split(line_buffer, ',', &num_tokens);
+static int compare_postings(const void *a, const void *b) {
+    const MarkPosting *pa = a, *pb = b;
+    if (pa->mark != pb->mark) return pa->mark < pb->mark ? -1 : 1;
+    return (pa->record > pb->record) - (pa->record < pb->record);
+}
 
-        if (tokens == NULL) { fprintf(stderr, "Error splitting line (memory): %s\n", line_buffer); continue; }
+// First position in `postings` whose (mark, record) is >= the given pair.
+static size_t posting_lower_bound(const MarkPosting *postings, size_t size, int mark, int record) {
+    MarkPosting key = { mark, record };
+    size_t lo = 0, hi = size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_postings(&postings[mid], &key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
 
-        if (num_tokens == 5) { 
-            Student s;
-            initialize_student_marks(&s); 
-            s.id = NULL; s.name = NULL; s.major = NULL; 
+// Inserts (mark, record) into the list for (semester, subject), at its sorted
+// position or, when `append` is set, at the end.
+static bool mark_index_put(int semester_number, Symbol subject, int mark, int record, bool append) {
+    if (subject == SYMBOL_NONE) return true;
+    PostingList *list = mark_index_find_or_create(semester_number, subject);
+    if (!list) return false;
+    if (list->size == list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        MarkPosting *temp = realloc(list->postings, new_capacity * sizeof(MarkPosting));
+        if (!temp) return false;
+        list->postings = temp;
+        list->capacity = new_capacity;
+    }
+    size_t pos = append ? list->size : posting_lower_bound(list->postings, list->size, mark, record);
+    memmove(&list->postings[pos + 1], &list->postings[pos], (list->size - pos) * sizeof(MarkPosting));
+    list->postings[pos].mark = mark;
+    list->postings[pos].record = record;
+    list->size++;
+    store_compact_posting_inserted(list, pos, list->postings[pos]);
+    return true;
+}
+
+// O(log p) search plus a memmove within one posting list.
+bool mark_index_add(int semester_number, Symbol subject, int mark, int record) {
+    return mark_index.deferred || mark_index_put(semester_number, subject, mark, record, false);
+}
 
-            bool success_age_parse, success_age_format;
+// O(log p). Position of the first posting with a mark of at least `min_mark`.
+size_t mark_index_first_at_least(const PostingList *list, int min_mark) {
+    return posting_lower_bound(list->postings, list->size, min_mark, INT32_MIN);
+}
 
-            
-            if (string_is_empty(tokens[0]) || !string_is_digit(tokens[0]) || strlen(tokens[0]) > MAX_ID_LENGTH) {
-                fprintf(stderr, "Warning: Invalid ID format/length in line: %s. Skipping.\n", line_buffer);
-                free_string_array(tokens, num_tokens); continue;
-            }
-            s.id = string_copy(tokens[0]);
-            if (!s.id) { fprintf(stderr, "Memory allocation failed for student ID: %s. Skipping.\n", line_buffer); free_string_array(tokens, num_tokens); continue;}
-            if (find_student_by_id(s.id) != -1) { 
-                 fprintf(stderr, "Warning: Duplicate Student ID '%s' found in file. Skipping record: %s\n", s.id, line_buffer);
-                 free_string(s.id); free_string_array(tokens, num_tokens); continue;
+void mark_index_remove(int semester_number, Symbol subject, int mark, int record) {
+    if (subject == SYMBOL_NONE || mark_index.deferred) return;
+    PostingList *list = mark_index_find(semester_number, subject);
+    if (!list) return;
+    size_t pos = posting_lower_bound(list->postings, list->size, mark, record);
+    if (pos == list->size || list->postings[pos].mark != mark || list->postings[pos].record != record) return;
+    store_compact_posting_removed(list, pos, list->postings[pos]);
+    memmove(&list->postings[pos], &list->postings[pos + 1], (list->size - pos - 1) * sizeof(MarkPosting));
+    list->size--;
+}
+
+// Rebuilds every posting list from the live records: one append per subject cell,
+// then one sort per list, instead of a memmove per posting. On allocation failure
+// the index is left missing some postings. Like id_order_build(), it ends any
+// compaction round.
+bool mark_index_build(void) {
+    store_compact_abort();
+    bool ok = true;
+    for (size_t l = 0; l < mark_index.list_count; l++) mark_index.lists[l].size = 0;
+    for (int i = 0; ok && i < student_store.count; i++) {
+        if (!student_is_live(i)) continue;
+        const MarkList *marks = student_marks(i);
+        int semester = 0;
+        for (uint32_t c = 0; ok && c < marks->count; c++) {
+            if (mark_cell_is_header(marks->cells[c])) semester = (int)marks->cells[c].value;
+            else ok = mark_index_put(semester, marks->cells[c].value, marks->cells[c].mark, i, true);
+        }
+    }
+    mark_index.deferred = false;
+    for (size_t l = 0; l < mark_index.list_count; l++) {
+        PostingList *list = &mark_index.lists[l];
+        qsort(list->postings, list->size, sizeof(MarkPosting), compare_postings);
+    }
+    return ok;
+}
+
+void mark_index_release(void) {
+    for (size_t l = 0; l < mark_index.list_count; l++) {
+        free(mark_index.lists[l].postings);
+    }
+    free(mark_index.lists);
+    free(mark_index.slots);
+    mark_index.lists = NULL;
+    mark_index.list_count = 0;
+    mark_index.list_capacity = 0;
+    mark_index.slots = NULL;
+    mark_index.slot_capacity = 0;
+}
+
+// Ends the round, dropping a partial copy. Every phase leaves the store and its
+// indexes consistent between steps, so stopping anywhere is safe: slots the slide
+// emptied but has not refilled stay behind as tombstones for the next round.
+void store_compact_abort(void) {
+    free(store_compaction.copy);
+    store_compaction = (StoreCompaction){ COMPACT_IDLE, 0, 0, NULL, 0, 0, 0, 0 };
+}
+
+static bool store_compact_reserve(size_t needed, size_t width) {
+    StoreCompaction *c = &store_compaction;
+    if (c->copy != NULL && needed <= c->copy_capacity) return true;
+    size_t new_capacity = c->copy_capacity == 0 ? 8 : c->copy_capacity * 2;
+    while (new_capacity < needed) new_capacity *= 2;
+    void *temp = realloc(c->copy, new_capacity * width);
+    if (!temp) return false;
+    c->copy = temp;
+    c->copy_capacity = new_capacity;
+    return true;
+}
+
+// Inserts and removes that land in the part of id_order, or of the posting list,
+// already copied are applied to the copy as well. On allocation failure the round ends.
+static bool store_compact_order_copied(size_t pos) {
+    const StoreCompaction *c = &store_compaction;
+    return c->phase == COMPACT_PURGE_ORDER && c->copy != NULL && pos < c->cursor;
+}
+
+static bool store_compact_posting_copied(const PostingList *list, size_t pos) {
+    const StoreCompaction *c = &store_compaction;
+    return c->phase == COMPACT_PURGE_MARKS && c->copy != NULL && list == &mark_index.lists[c->list] && pos < c->cursor;
+}
+
+void store_compact_order_inserted(size_t pos, int index) {
+    StoreCompaction *c = &store_compaction;
+    if (!store_compact_order_copied(pos)) return;
+    c->cursor++;
+    if (!store_compact_reserve(c->copy_size + 1, sizeof(int))) {
+        store_compact_abort();
+        return;
+    }
+    int *copy = c->copy;
+    const char *id = student_id(index);
+    size_t at = id_lower_bound(copy, c->copy_size, id, strlen(id) + 1, false);
+    memmove(&copy[at + 1], &copy[at], (c->copy_size - at) * sizeof(int));
+    copy[at] = index;
+    c->copy_size++;
+}
+
+void store_compact_order_removed(size_t pos, int index) {
+    StoreCompaction *c = &store_compaction;
+    if (!store_compact_order_copied(pos)) return;
+    c->cursor--;
+    int *copy = c->copy;
+    size_t at = id_entry_find(copy, c->copy_size, index);
+    if (at == c->copy_size) return;
+    memmove(&copy[at], &copy[at + 1], (c->copy_size - at - 1) * sizeof(int));
+    c->copy_size--;
+}
+
+void store_compact_posting_inserted(const PostingList *list, size_t pos, MarkPosting posting) {
+    StoreCompaction *c = &store_compaction;
+    if (!store_compact_posting_copied(list, pos)) return;
+    c->cursor++;
+    if (!store_compact_reserve(c->copy_size + 1, sizeof(MarkPosting))) {
+        store_compact_abort();
+        return;
+    }
+    MarkPosting *copy = c->copy;
+    size_t at = posting_lower_bound(copy, c->copy_size, posting.mark, posting.record);
+    memmove(&copy[at + 1], &copy[at], (c->copy_size - at) * sizeof(MarkPosting));
+    copy[at] = posting;
+    c->copy_size++;
+}
+
+void store_compact_posting_removed(const PostingList *list, size_t pos, MarkPosting posting) {
+    StoreCompaction *c = &store_compaction;
+    if (!store_compact_posting_copied(list, pos)) return;
+    c->cursor--;
+    MarkPosting *copy = c->copy;
+    size_t at = posting_lower_bound(copy, c->copy_size, posting.mark, posting.record);
+    if (at == c->copy_size || copy[at].mark != posting.mark || copy[at].record != posting.record) return;
+    memmove(&copy[at], &copy[at + 1], (c->copy_size - at - 1) * sizeof(MarkPosting));
+    c->copy_size--;
+}
+
+// Copies up to `budget` entries of id_order, keeping the live records', and
+// swaps the copy in once it is complete. Returns the budget left.
+static int store_compact_purge_order(int budget) {
+    StoreCompaction *c = &store_compaction;
+    // A deferred id_order is rebuilt from the live records anyway.
+    if (!id_order.deferred) {
+        if (c->copy == NULL && !store_compact_reserve(id_order.size, sizeof(int))) {
+            store_compact_abort();
+            return 0;
+        }
+        for (; budget > 0 && c->cursor < id_order.size; budget--) {
+            int record = id_order.entries[c->cursor++];
+            if (!student_is_live(record)) continue;
+            if (!store_compact_reserve(c->copy_size + 1, sizeof(int))) {
+                store_compact_abort();
+                return 0;
             }
+            ((int *)c->copy)[c->copy_size++] = record;
+        }
+        if (c->cursor < id_order.size) return budget;
+        free(id_order.entries);
+        id_order.entries = c->copy;
+        id_order.size = c->copy_size;
+        id_order.capacity = c->copy_capacity;
+        c->copy = NULL;
+    }
+    free(c->copy);
+    *c = (StoreCompaction){ COMPACT_PURGE_MARKS, 0, 0, NULL, 0, 0, 0, 0 };
+    return budget;
+}
 
-            
-            s.name = string_copy(tokens[1]);
-            if(!s.name && tokens[1] && !string_is_empty(tokens[1])) { 
-                fprintf(stderr, "Memory allocation failed for student Name: %s. Skipping.\n", line_buffer);
-                free_string(s.id); free_string_array(tokens, num_tokens); continue;
+// The same for each posting list in turn; an empty list costs one unit.
+static int store_compact_purge_marks(int budget) {
+    StoreCompaction *c = &store_compaction;
+    while (!mark_index.deferred && c->list < mark_index.list_count) {
+        if (budget <= 0) return 0;
+        PostingList *list = &mark_index.lists[c->list];
+        if (c->copy == NULL && !store_compact_reserve(list->size, sizeof(MarkPosting))) {
+            store_compact_abort();
+            return 0;
+        }
+        for (; budget > 0 && c->cursor < list->size; budget--) {
+            MarkPosting posting = list->postings[c->cursor++];
+            if (!student_is_live(posting.record)) continue;
+            if (!store_compact_reserve(c->copy_size + 1, sizeof(MarkPosting))) {
+                store_compact_abort();
+                return 0;
             }
+            ((MarkPosting *)c->copy)[c->copy_size++] = posting;
+        }
+        if (c->cursor < list->size) return budget;
+        free(list->postings);
+        list->postings = c->copy;
+        list->size = c->copy_size;
+        list->capacity = c->copy_capacity;
+        c->copy = NULL;
+        c->copy_size = 0;
+        c->copy_capacity = 0;
+        c->cursor = 0;
+        c->list++;
+        budget--;
+    }
+    free(c->copy);
+    *c = (StoreCompaction){ COMPACT_SLIDE, 0, 0, NULL, 0, 0, 0, 0 };
+    return budget;
+}
+
+// Points the index entries of record `from` at `to`: `from` itself, or the first
+// free slot below it. Nothing refers to the slots in between, so sorted indexes
+// stay sorted. Returns false if no entry refers to the record.
+static bool store_compact_renumber(int from, int to) {
+    bool found = false;
+    if (student_is_live(from) && id_index.size > 0) {
+        size_t slot = id_index_probe(student_id(from));
+        if (id_index.slots[slot] == from) {
+            id_index.slots[slot] = to;
+            found = true;
+        }
+    }
+    if (!id_order.deferred) {
+        size_t pos = id_entry_find(id_order.entries, id_order.size, from);
+        if (pos < id_order.size) {
+            id_order.entries[pos] = to;
+            found = true;
+        }
+    }
+    const MarkList *marks = student_marks(from);
+    int semester = 0;
+    for (uint32_t i = 0; !mark_index.deferred && i < marks->count; i++) {
+        MarkCell cell = marks->cells[i];
+        if (mark_cell_is_header(cell)) {
+            semester = (int)cell.value;
+            continue;
+        }
+        PostingList *list = mark_index_find(semester, cell.value);
+        if (!list) continue;
+        size_t pos = posting_lower_bound(list->postings, list->size, cell.mark, from);
+        if (pos < list->size && list->postings[pos].mark == cell.mark && list->postings[pos].record == from) {
+            list->postings[pos].record = to;
+            found = true;
+        }
+    }
+    return found;
+}
 
+// Leaves the slot at `index` a tombstone that owns nothing. Its marks are freed
+// when `release` is set; otherwise they were moved to another slot.
+static void store_compact_vacate(int index, bool release) {
+    StudentChunk *chunk = student_chunk(index);
+    int slot = student_slot(index);
+    if (release) mark_list_release(&chunk->marks[slot]);
+    chunk->marks[slot] = (MarkList){ NULL, 0 };
+    memset(&chunk->names[slot], 0, sizeof(SmallName));
+    chunk->ids[slot][0] = '\0';
+    chunk->ages[slot] = 0;
+}
 
-            
-            s.age = (int)string_to_double(tokens[2], &success_age_parse); 
-            success_age_format = string_is_int(tokens[2]);
-            if (!success_age_parse || !success_age_format || s.age <= 0) {
-                fprintf(stderr, "Warning: Invalid Age format/value in line: %s. Skipping.\n", line_buffer);
-                free_string(s.id); free_string(s.name);
-                free_string_array(tokens, num_tokens);
-                continue;
+// Moves up to `budget` records down over the free slots, keeping insertion order.
+// A tombstone that still has index entries (deleted after the purge passed them)
+// moves like a live record and waits for the next round.
+static int store_compact_slide(int budget) {
+    StoreCompaction *c = &store_compaction;
+    for (; budget > 0 && c->read < student_store.count; budget--) {
+        int from = c->read++;
+        bool live = student_is_live(from);
+        if (!store_compact_renumber(from, c->write) && !live) {
+            store_compact_vacate(from, true);
+            continue;
+        }
+        if (from != c->write) {
+            Student row;
+            student_load(from, &row);
+            student_store_at(c->write, &row);
+            store_compact_vacate(from, false);
+        }
+        c->write++;
+    }
+    if (c->read < student_store.count) return budget;
+    student_store.tombstones -= student_store.count - c->write;
+    student_store.count = c->write;
+    // Keep one spare chunk so a delete/add cycle at a boundary does not thrash.
+    size_t needed = ((size_t)student_store.count >> STUDENT_CHUNK_SHIFT) + 1;
+    while (student_store.chunk_count > needed) free(student_store.chunks[--student_store.chunk_count]);
+    store_compaction.phase = COMPACT_IDLE;
+    return budget;
+}
+
+// Advances the compaction round by about `budget` index entries or records,
+// starting one once a quarter of the store is tombstones. A round is
+// O(records + postings), so each delete pays a bounded, amortized O(1) share of
+// it and no single operation pays for the whole store.
+void store_compact_step(int budget) {
+    StoreCompaction *c = &store_compaction;
+    if (c->phase == COMPACT_IDLE) {
+        if (student_store.tombstones < STORE_COMPACT_MIN_TOMBSTONES ||
+            student_store.tombstones * 4 < student_store.count) return;
+        c->phase = COMPACT_PURGE_ORDER;
+    }
+    while (budget > 0 && c->phase != COMPACT_IDLE) {
+        if (c->phase == COMPACT_PURGE_ORDER) budget = store_compact_purge_order(budget);
+        else if (c->phase == COMPACT_PURGE_MARKS) budget = store_compact_purge_marks(budget);
+        else budget = store_compact_slide(budget);
+    }
+}
+
+static size_t hash_bytes(const char *s, size_t length) {
+    size_t h = (size_t)14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)s[i];
+        h *= (size_t)1099511628211ULL;
+    }
+    return h;
+}
+
+// Returns the slot holding `name`, or the empty slot where it would go. Caller holds symbols.lock.
+static size_t symbol_probe(const char *name, size_t length) {
+    size_t mask = symbols.slot_capacity - 1;
+    size_t slot = hash_bytes(name, length) & mask;
+    while (symbols.slots[slot] != SYMBOL_NONE) {
+        const char *candidate = symbols.names[symbols.slots[slot]];
+        if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0') break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Caller holds symbols.lock for writing.
+static bool symbol_table_grow(void) {
+    if (symbols.count == symbols.capacity) {
+        size_t new_capacity = symbols.capacity == 0 ? 64 : symbols.capacity * 2;
+        string *temp = realloc(symbols.names, new_capacity * sizeof(string));
+        if (!temp) return false;
+        symbols.names = temp;
+        symbols.capacity = new_capacity;
+        if (symbols.count == 0) symbols.names[symbols.count++] = NULL; // SYMBOL_NONE
+    }
+    if ((symbols.count + 1) * 2 <= symbols.slot_capacity) return true;
+    size_t new_capacity = symbols.slot_capacity == 0 ? ID_INDEX_MIN_CAPACITY : symbols.slot_capacity * 2;
+    Symbol *new_slots = calloc(new_capacity, sizeof(Symbol));
+    if (!new_slots) return false;
+    free(symbols.slots);
+    symbols.slots = new_slots;
+    symbols.slot_capacity = new_capacity;
+    for (size_t k = 1; k < symbols.count; k++) {
+        symbols.slots[symbol_probe(symbols.names[k], strlen(symbols.names[k]))] = (Symbol)k;
+    }
+    return true;
+}
+
+static Symbol symbol_find(const char *name, size_t length) {
+    if (symbols.slot_capacity == 0) return SYMBOL_NONE;
+    return symbols.slots[symbol_probe(name, length)];
+}
+
+// O(length) expected. Returns the symbol for the `length` bytes at `name`, adding
+// it if new, or SYMBOL_NONE if memory runs out or SYMBOL_MAX symbols already
+// exist. Safe to call from import workers.
+Symbol symbol_intern_n(const char *name, size_t length) {
+    pthread_rwlock_rdlock(&symbols.lock);
+    Symbol symbol = symbol_find(name, length);
+    pthread_rwlock_unlock(&symbols.lock);
+    if (symbol != SYMBOL_NONE) return symbol;
+
+    pthread_rwlock_wrlock(&symbols.lock);
+    symbol = symbol_find(name, length);
+    if (symbol == SYMBOL_NONE && symbols.count <= SYMBOL_MAX && symbol_table_grow()) {
+        string copy = arena_copy_n(&symbols.strings, name, length);
+        if (copy) {
+            symbol = (Symbol)symbols.count;
+            symbols.names[symbols.count++] = copy;
+            symbols.slots[symbol_probe(name, length)] = symbol;
+        }
+    }
+    pthread_rwlock_unlock(&symbols.lock);
+    return symbol;
+}
+
+Symbol symbol_intern(const char *name) {
+    return symbol_intern_n(name, strlen(name));
+}
+
+// Returns SYMBOL_NONE if `name` was never interned, without adding it.
+Symbol symbol_lookup(const char *name) {
+    pthread_rwlock_rdlock(&symbols.lock);
+    Symbol symbol = symbol_find(name, strlen(name));
+    pthread_rwlock_unlock(&symbols.lock);
+    return symbol;
+}
+
+const char *symbol_name(Symbol symbol) {
+    return symbol == SYMBOL_NONE ? NULL : symbols.names[symbol];
+}
+
+const char *symbol_text(Symbol symbol, const char *fallback) {
+    const char *name = symbol_name(symbol);
+    return name ? name : fallback;
+}
+
+void symbol_table_release(void) {
+    arena_release(&symbols.strings);
+    free(symbols.names);
+    free(symbols.slots);
+    symbols.names = NULL;
+    symbols.count = 0;
+    symbols.capacity = 0;
+    symbols.slots = NULL;
+    symbols.slot_capacity = 0;
+}
+
+// Recursive-descent compiler for filter expressions. Grammar, loosest first:
+//   or  := and { ("or" | "||") and }
+//   and := not { ("and" | "&&") not }
+//   not := ("not" | "!") not | "(" or ")" | field op literal
+typedef struct {
+    const char *text;
+    const char *cursor;
+    Query *query;
+    char *error;
+    size_t error_size;
+    bool failed;
+} QueryParser;
+
+static bool query_fail(QueryParser *parser, const char *message) {
+    if (!parser->failed) {
+        snprintf(parser->error, parser->error_size, "%s at column %d", message, (int)(parser->cursor - parser->text) + 1);
+        parser->failed = true;
+    }
+    return false;
+}
+
+static bool query_is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static void query_skip_space(QueryParser *parser) {
+    while (isspace((unsigned char)*parser->cursor)) parser->cursor++;
+}
+
+// Consumes `word` (case-insensitive) if it comes next as a whole word.
+static bool query_accept_word(QueryParser *parser, const char *word) {
+    query_skip_space(parser);
+    size_t length = strlen(word);
+    for (size_t i = 0; i < length; i++) {
+        if (tolower((unsigned char)parser->cursor[i]) != word[i]) return false;
+    }
+    if (query_is_word_char(parser->cursor[length])) return false;
+    parser->cursor += length;
+    return true;
+}
+
+static bool query_accept(QueryParser *parser, const char *symbol) {
+    query_skip_space(parser);
+    size_t length = strlen(symbol);
+    if (strncmp(parser->cursor, symbol, length) != 0) return false;
+    parser->cursor += length;
+    return true;
+}
+
+static bool query_emit(QueryParser *parser, QueryInstr instr) {
+    Query *query = parser->query;
+    if (query->count == query->capacity) {
+        size_t new_capacity = query->capacity == 0 ? 16 : query->capacity * 2;
+        QueryInstr *temp = realloc(query->code, new_capacity * sizeof(QueryInstr));
+        if (!temp) { free(instr.text); return query_fail(parser, "out of memory"); }
+        query->code = temp;
+        query->capacity = new_capacity;
+    }
+    query->code[query->count++] = instr;
+    return true;
+}
+
+static bool query_add_hint(QueryParser *parser, size_t position) {
+    Query *query = parser->query;
+    if (query->hint_count == query->hint_capacity) {
+        size_t new_capacity = query->hint_capacity == 0 ? 4 : query->hint_capacity * 2;
+        size_t *temp = realloc(query->hints, new_capacity * sizeof(size_t));
+        if (!temp) return query_fail(parser, "out of memory");
+        query->hints = temp;
+        query->hint_capacity = new_capacity;
+    }
+    query->hints[query->hint_count++] = position;
+    return true;
+}
+
+// A quoted string ('...' or "...", no escapes), or a bare word of letters, digits
+// and '_' (optionally starting with '-'). Returns its length and start, or 0 with
+// `*start` NULL if neither comes next.
+static size_t query_take_text(QueryParser *parser, const char **start, bool *quoted) {
+    query_skip_space(parser);
+    const char *cursor = parser->cursor;
+    *start = NULL;
+    *quoted = *cursor == '"' || *cursor == '\'';
+    if (*quoted) {
+        const char *close = strchr(cursor + 1, *cursor);
+        if (close == NULL) return query_fail(parser, "unterminated string");
+        *start = cursor + 1;
+        parser->cursor = close + 1;
+        return (size_t)(close - cursor - 1);
+    }
+    while (query_is_word_char(*cursor) || (cursor == parser->cursor && *cursor == '-')) cursor++;
+    if (cursor == parser->cursor) return 0;
+    *start = parser->cursor;
+    parser->cursor = cursor;
+    return (size_t)(cursor - *start);
+}
+
+static bool query_parse_cmp(QueryParser *parser, uint8_t *cmp) {
+    static const struct { const char *symbol; QueryCmp cmp; } operators[] = {
+        { "==", QUERY_EQ }, { "!=", QUERY_NE }, { "<=", QUERY_LE }, { ">=", QUERY_GE },
+        { "<", QUERY_LT }, { ">", QUERY_GT }, { "=", QUERY_EQ },
+    };
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        if (query_accept(parser, operators[i].symbol)) {
+            *cmp = (uint8_t)operators[i].cmp;
+            return true;
+        }
+    }
+    return query_fail(parser, "expected == != < <= > or >=");
+}
+
+// Numbers are kept well inside int range, so comparisons and `value + 1` cannot overflow.
+static bool query_parse_int(QueryParser *parser, int32_t *value) {
+    const char *start;
+    bool quoted, ok = false;
+    size_t length = query_take_text(parser, &start, &quoted);
+    if (start != NULL && !quoted) *value = string_n_to_int(start, length, &ok);
+    if (ok && (*value < -QUERY_MAX_NUMBER || *value > QUERY_MAX_NUMBER)) return query_fail(parser, "number out of range");
+    return ok || query_fail(parser, "expected a whole number");
+}
+
+static bool query_at_semester(const QueryParser *parser) {
+    const char *field = parser->cursor;
+    return (*field == 'S' || *field == 's') && isdigit((unsigned char)field[1]);
+}
+
+// Parses "S<semester>.<subject>". `*subject` is SYMBOL_NONE for a subject nobody
+// has. `*start`/`*length`/`*quoted` describe the subject text as written.
+static bool query_parse_semester_subject(QueryParser *parser, int *semester, Symbol *subject,
+                                         const char **start, size_t *length, bool *quoted) {
+    const char *dot = parser->cursor + 1;
+    while (isdigit((unsigned char)*dot)) dot++;
+    bool ok;
+    *semester = string_n_to_int(parser->cursor + 1, (size_t)(dot - parser->cursor - 1), &ok);
+    if (*dot != '.' || !ok || *semester < 1 || *semester > MARKS_LIMIT_CEILING) {
+        return query_fail(parser, "expected S<semester>.<subject>");
+    }
+    parser->cursor = dot + 1;
+    *length = query_take_text(parser, start, quoted);
+    if (*start == NULL) return query_fail(parser, "expected a subject name");
+    *subject = SYMBOL_NONE;
+    if (*length <= MAX_SUBJECT_NAME_LENGTH) {
+        char name[MAX_SUBJECT_NAME_LENGTH + 1];
+        memcpy(name, *start, *length);
+        name[*length] = '\0';
+        *subject = symbol_lookup(name);
+    }
+    return true;
+}
+
+// field op literal. Comparisons on a subject nobody has compile to a constant.
+static bool query_parse_comparison(QueryParser *parser) {
+    query_skip_space(parser);
+    QueryInstr instr = { 0, 0, 0, SYMBOL_NONE, 0, NULL };
+    bool hint = false;
+    if (query_at_semester(parser)) {
+        int semester;
+        const char *subject;
+        size_t length;
+        bool quoted;
+        if (!query_parse_semester_subject(parser, &semester, &instr.symbol, &subject, &length, &quoted)) return false;
+        instr.op = QUERY_MARK;
+        instr.semester = (uint16_t)semester;
+        if (!query_parse_cmp(parser, &instr.cmp) || !query_parse_int(parser, &instr.value)) return false;
+        if (instr.symbol == SYMBOL_NONE) {
+            instr.op = QUERY_CONSTANT;
+            instr.value = 0;
+        } else {
+            hint = instr.cmp != QUERY_NE;
+        }
+    } else if (query_accept_word(parser, "age")) {
+        instr.op = QUERY_AGE;
+        if (!query_parse_cmp(parser, &instr.cmp) || !query_parse_int(parser, &instr.value)) return false;
+    } else {
+        bool id = query_accept_word(parser, "id");
+        if (id) instr.op = QUERY_ID;
+        else if (query_accept_word(parser, "name")) instr.op = QUERY_NAME;
+        else if (query_accept_word(parser, "major")) instr.op = QUERY_MAJOR;
+        else return query_fail(parser, "expected id, name, age, major or S<semester>.<subject>");
+        if (!query_parse_cmp(parser, &instr.cmp)) return false;
+        const char *text;
+        bool quoted;
+        // IDs are digit strings, so they may also be written unquoted.
+        size_t length = query_take_text(parser, &text, &quoted);
+        if (text == NULL || (!quoted && !id)) return query_fail(parser, id ? "expected an ID" : "expected a quoted string");
+        if ((instr.text = string_copy_n(text, length)) == NULL) return query_fail(parser, "out of memory");
+        if (instr.op == QUERY_MAJOR && (instr.cmp == QUERY_EQ || instr.cmp == QUERY_NE)) {
+            instr.op = QUERY_MAJOR_IS;
+            instr.symbol = symbol_lookup(instr.text);
+            free_string(instr.text);
+            instr.text = NULL;
+        }
+        hint = id && instr.cmp != QUERY_NE;
+    }
+    if (!query_emit(parser, instr)) return false;
+    return !hint || query_add_hint(parser, parser->query->count - 1);
+}
+
+static bool query_parse_or(QueryParser *parser);
+
+static bool query_parse_not(QueryParser *parser) {
+    if (query_accept_word(parser, "not") || (query_accept(parser, "!"))) {
+        size_t hints = parser->query->hint_count;
+        if (!query_parse_not(parser)) return false;
+        parser->query->hint_count = hints; // A negated test no longer bounds the matches.
+        return query_emit(parser, (QueryInstr){ QUERY_NOT, 0, 0, SYMBOL_NONE, 0, NULL });
+    }
+    if (query_accept(parser, "(")) {
+        if (!query_parse_or(parser)) return false;
+        return query_accept(parser, ")") || query_fail(parser, "expected )");
+    }
+    return query_parse_comparison(parser);
+}
+
+// Parses operands joined by `word`/`symbol`, with each jump landing past the last operand.
+static bool query_parse_chain(QueryParser *parser, bool (*operand)(QueryParser *), const char *word,
+                              const char *symbol, QueryOp jump, bool *chained) {
+    if (!operand(parser)) return false;
+    int32_t pending = -1; // Unpatched jumps, linked through their `value`.
+    *chained = false;
+    while (query_accept_word(parser, word) || query_accept(parser, symbol)) {
+        *chained = true;
+        if (!query_emit(parser, (QueryInstr){ (uint8_t)jump, 0, 0, SYMBOL_NONE, pending, NULL })) return false;
+        pending = (int32_t)parser->query->count - 1;
+        if (!operand(parser)) return false;
+    }
+    while (pending != -1) {
+        int32_t next = parser->query->code[pending].value;
+        parser->query->code[pending].value = (int32_t)parser->query->count;
+        pending = next;
+    }
+    return true;
+}
+
+static bool query_parse_and(QueryParser *parser) {
+    bool chained;
+    return query_parse_chain(parser, query_parse_not, "and", "&&", QUERY_JUMP_IF_FALSE, &chained);
+}
+
+static bool query_parse_or(QueryParser *parser) {
+    size_t hints = parser->query->hint_count;
+    bool chained;
+    if (!query_parse_chain(parser, query_parse_and, "or", "||", QUERY_JUMP_IF_TRUE, &chained)) return false;
+    if (chained) parser->query->hint_count = hints; // Either side alone may match.
+    return true;
+}
+
+// Compiles `text` into `query`. On failure, describes the problem in `error`
+// and leaves nothing to free.
+bool query_compile(const char *text, Query *query, char *error, size_t error_size) {
+    *query = (Query){ NULL, 0, 0, NULL, 0, 0 };
+    QueryParser parser = { text, text, query, error, error_size, false };
+    bool ok = query_parse_or(&parser);
+    query_skip_space(&parser);
+    if (ok && *parser.cursor != '\0') ok = query_fail(&parser, "unexpected text");
+    if (!ok) query_free(query);
+    return ok;
+}
+
+void query_free(Query *query) {
+    for (size_t i = 0; i < query->count; i++) free(query->code[i].text);
+    free(query->code);
+    free(query->hints);
+    *query = (Query){ NULL, 0, 0, NULL, 0, 0 };
+}
+
+static bool query_holds(int order, uint8_t cmp) {
+    switch (cmp) {
+        case QUERY_EQ: return order == 0;
+        case QUERY_NE: return order != 0;
+        case QUERY_LT: return order < 0;
+        case QUERY_LE: return order <= 0;
+        case QUERY_GT: return order > 0;
+        default: return order >= 0;
+    }
+}
+
+static bool query_matches(const Query *query, int record) {
+    bool result = true;
+    const QueryInstr *code = query->code;
+    for (size_t pc = 0; pc < query->count; pc++) {
+        const QueryInstr *instr = &code[pc];
+        switch (instr->op) {
+            case QUERY_CONSTANT: result = instr->value != 0; break;
+            case QUERY_ID: result = query_holds(strcmp(student_id(record), instr->text), instr->cmp); break;
+            case QUERY_NAME: result = query_holds(strcmp(student_name(record), instr->text), instr->cmp); break;
+            case QUERY_AGE: result = query_holds(student_age(record) - instr->value, instr->cmp); break;
+            case QUERY_MAJOR_IS: result = (student_major(record) == instr->symbol) == (instr->cmp == QUERY_EQ); break;
+            case QUERY_MAJOR:
+                result = query_holds(strcmp(symbol_text(student_major(record), ""), instr->text), instr->cmp);
+                break;
+            case QUERY_MARK: {
+                int mark;
+                result = mark_list_find_mark(student_marks(record), instr->semester, instr->symbol, &mark) &&
+                         query_holds(mark - instr->value, instr->cmp);
+                break;
             }
+            case QUERY_NOT: result = !result; break;
+            case QUERY_JUMP_IF_FALSE: if (!result) pc = (size_t)instr->value - 1; break;
+            case QUERY_JUMP_IF_TRUE: if (result) pc = (size_t)instr->value - 1; break;
+        }
+    }
+    return result;
+}
+
+// The records a query has to look at: one ID, a run of id_order, a run of a
+// posting list, or (with no usable index) every slot in the store.
+typedef struct {
+    enum { QUERY_SCAN, QUERY_BY_ID, QUERY_BY_ID_ORDER, QUERY_BY_MARK } kind;
+    int record;
+    const PostingList *list;
+    size_t begin;
+    size_t end;
+} QueryPlan;
 
-            
-            s.major = string_copy(tokens[3]);
-             if(!s.major && tokens[3] && !string_is_empty(tokens[3])) {
-                fprintf(stderr, "Memory allocation failed for student Major: %s. Skipping.\n", line_buffer);
-                free_string(s.id); free_string(s.name); free_string_array(tokens, num_tokens); continue;
+// Picks the index that leaves the fewest candidates. Indexes that are deferred
+// (during batch writes) are skipped rather than rebuilt.
+static QueryPlan query_plan(const Query *query) {
+    QueryPlan best = { QUERY_SCAN, -1, NULL, 0, (size_t)student_store.count };
+    size_t id_begin = 0, id_end = id_order.size;
+    bool id_range = false;
+    for (size_t h = 0; h < query->hint_count; h++) {
+        const QueryInstr *instr = &query->code[query->hints[h]];
+        QueryPlan plan = best;
+        if (instr->op == QUERY_ID && instr->cmp == QUERY_EQ) {
+            int record = find_student_by_id(instr->text);
+            plan = (QueryPlan){ QUERY_BY_ID, record, NULL, 0, record == -1 ? 0 : 1 };
+        } else if (instr->op == QUERY_ID && !id_order.deferred) {
+            bool upper = instr->cmp == QUERY_LT || instr->cmp == QUERY_LE;
+            size_t position = id_order_position(instr->text, instr->cmp == QUERY_LE || instr->cmp == QUERY_GT);
+            if (upper && position < id_end) id_end = position;
+            if (!upper && position > id_begin) id_begin = position;
+            id_range = true;
+            continue;
+        } else if (instr->op == QUERY_MARK && !mark_index.deferred) {
+            const PostingList *list = mark_index_find(instr->semester, instr->symbol);
+            size_t begin = 0, end = list ? list->size : 0;
+            if (list && instr->cmp != QUERY_LT && instr->cmp != QUERY_LE) {
+                begin = mark_index_first_at_least(list, instr->cmp == QUERY_GT ? instr->value + 1 : instr->value);
             }
+            if (list && instr->cmp != QUERY_GT && instr->cmp != QUERY_GE) {
+                end = mark_index_first_at_least(list, instr->cmp == QUERY_LT ? instr->value : instr->value + 1);
+            }
+            plan = (QueryPlan){ QUERY_BY_MARK, -1, list, begin, end > begin ? end : begin };
+        }
+        if (plan.end - plan.begin < best.end - best.begin) best = plan;
+    }
+    if (id_range) {
+        if (id_end < id_begin) id_end = id_begin;
+        if (id_end - id_begin < best.end - best.begin) best = (QueryPlan){ QUERY_BY_ID_ORDER, -1, NULL, id_begin, id_end };
+    }
+    return best;
+}
 
-            
-            if (!parse_marks_from_string(&s, tokens[4])) {
-                fprintf(stderr, "Warning: Error parsing marks for student %s. Marks may be incomplete or missing.\n", s.id);
-                
-                
-                
+// Runs `query` over the live records and returns the matches in ascending ID
+// order in a malloc'd array (NULL when there are none). Every candidate an
+// index yields is checked against the whole program, so stale postings and
+// the other tests are handled the same way as in a scan.
+bool query_run(const Query *query, int **matches, size_t *count) {
+    *matches = NULL;
+    *count = 0;
+    QueryPlan plan = query_plan(query);
+    size_t capacity = 0;
+    for (size_t i = plan.begin; i < plan.end; i++) {
+        int record;
+        switch (plan.kind) {
+            case QUERY_BY_ID: record = plan.record; break;
+            case QUERY_BY_ID_ORDER: record = id_order.entries[i]; break;
+            case QUERY_BY_MARK: record = plan.list->postings[i].record; break;
+            default: record = (int)i; break;
+        }
+        if (!student_is_live(record) || !query_matches(query, record)) continue;
+        if (*count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            int *temp = realloc(*matches, capacity * sizeof(int));
+            if (!temp) {
+                free(*matches);
+                *matches = NULL;
+                *count = 0;
+                return false;
             }
+            *matches = temp;
+        }
+        (*matches)[(*count)++] = record;
+    }
+    if (plan.kind != QUERY_BY_ID_ORDER && *count > 1) qsort(*matches, *count, sizeof(int), compare_indices_by_id);
+    return true;
+}
 
-            students[student_count++] = s; 
-        } else {
-            fprintf(stderr, "Warning: Malformed line in %s (expected 5 fields, got %zu): %s. Skipping.\n",
-                    DATABASE_FILE, num_tokens, line_buffer);
+// Grade points on a 10-point scale: O 90+, A+ 75+, A 65+, B+ 55+, B 50+, C 45+, P 40+, else F.
+int grade_point(int mark) {
+    static const struct { int min_mark; int points; } grades[] = {
+        { 90, 10 }, { 75, 9 }, { 65, 8 }, { 55, 7 }, { 50, 6 }, { 45, 5 }, { 40, 4 },
+    };
+    for (size_t i = 0; i < sizeof(grades) / sizeof(grades[0]); i++) {
+        if (mark >= grades[i].min_mark) return grades[i].points;
+    }
+    return 0;
+}
+
+static bool grade_buffer_reserve(GradeBuffer *buffer, size_t needed) {
+    if (needed <= buffer->capacity) return true;
+    size_t new_capacity = buffer->capacity == 0 ? 32 : buffer->capacity;
+    while (new_capacity < needed) new_capacity *= 2;
+    int *marks = realloc(buffer->marks, new_capacity * sizeof(int));
+    if (marks) buffer->marks = marks;
+    int *points = realloc(buffer->points, new_capacity * sizeof(int));
+    if (points) buffer->points = points;
+    SemesterGrades *semesters = realloc(buffer->semesters, new_capacity * sizeof(SemesterGrades));
+    if (semesters) buffer->semesters = semesters;
+    if (!marks || !points || !semesters) return false;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+void grade_buffer_free(GradeBuffer *buffer) {
+    free(buffer->marks);
+    free(buffer->points);
+    free(buffer->semesters);
+    *buffer = (GradeBuffer){ NULL, NULL, NULL, 0 };
+}
+
+// Lays the student's marks and grade points out as flat arrays, one run per
+// semester, and reduces each run (and the whole) with the aquant array functions.
+// `out->semesters` points into `buffer`, valid until its next use.
+bool student_grades(const MarkList *marks, GradeBuffer *buffer, StudentGrades *out) {
+    if (!grade_buffer_reserve(buffer, marks->count)) return false;
+    size_t n = 0, semester_count = 0;
+    for (uint32_t header = 0; header < marks->count; ) {
+        uint32_t end = mark_list_semester_end(marks, header);
+        size_t begin = n;
+        for (uint32_t i = header + 1; i < end; i++) {
+            buffer->marks[n] = (int)marks->cells[i].mark;
+            buffer->points[n] = grade_point(buffer->marks[n]);
+            n++;
         }
-        free_string_array(tokens, num_tokens);
+        if (n > begin) {
+            buffer->semesters[semester_count++] = (SemesterGrades){
+                (int)marks->cells[header].value, (int)(n - begin),
+                array_average(buffer->marks + begin, n - begin), array_average(buffer->points + begin, n - begin),
+            };
+        }
+        header = end;
     }
-    fclose(file);
+    *out = (StudentGrades){ (int)n, array_average(buffer->marks, n), array_average(buffer->points, n),
+                            0, 0, buffer->semesters, semester_count };
+    array_min(buffer->marks, n, &out->min);
+    array_max(buffer->marks, n, &out->max);
     return true;
 }
 
-bool save_students_to_file(const char *filename) {
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        fprintf(stderr, "Error: Could not open file %s for writing.\n", filename);
+double subject_stats_mean(const SubjectStats *stats) {
+    return stats->count == 0 ? NAN : (double)stats->sum / (double)stats->count;
+}
+
+// Population standard deviation. The sums are exact integers, so the
+// one-pass formula loses nothing to cancellation at mark magnitudes.
+double subject_stats_stddev(const SubjectStats *stats) {
+    if (stats->count == 0) return NAN;
+    double mean = subject_stats_mean(stats);
+    double variance = (double)stats->sum_squares / (double)stats->count - mean * mean;
+    return variance > 0 ? sqrt(variance) : 0.0;
+}
+
+static int compare_subject_stats(const void *a, const void *b) {
+    return strcmp(symbol_text(((const SubjectStats *)a)->subject, ""), symbol_text(((const SubjectStats *)b)->subject, ""));
+}
+
+// One streaming pass over the live students, in ID order unless id_order is
+// deferred (then in store order). Totals every subject's marks into a malloc'd
+// array sorted by subject name, and reports each student's grades to
+// `on_student` if it is set. Returns false when out of memory.
+bool marks_aggregate(SubjectStats **subjects, size_t *subject_count, StudentGradesFn on_student, void *context) {
+    *subjects = NULL;
+    *subject_count = 0;
+    // Indexed by subject symbol; majors share the symbol space and simply stay empty.
+    size_t slots = symbols.count > 0 ? symbols.count : 1;
+    SubjectStats *totals = calloc(slots, sizeof(SubjectStats));
+    if (!totals) return false;
+    GradeBuffer buffer = { NULL, NULL, NULL, 0 };
+    bool by_id = !id_order.deferred;
+    size_t records = by_id ? id_order.size : (size_t)student_store.count;
+    bool ok = true;
+    for (size_t i = 0; ok && i < records; i++) {
+        int record = by_id ? id_order.entries[i] : (int)i;
+        if (!student_is_live(record)) continue;
+        const MarkList *marks = student_marks(record);
+        for (uint32_t c = 0; c < marks->count; c++) {
+            MarkCell cell = marks->cells[c];
+            if (mark_cell_is_header(cell) || cell.value >= slots) continue;
+            SubjectStats *stats = &totals[cell.value];
+            int mark = (int)cell.mark;
+            if (stats->count == 0 || mark < stats->min) stats->min = mark;
+            if (stats->count == 0 || mark > stats->max) stats->max = mark;
+            stats->count++;
+            stats->sum += mark;
+            stats->sum_squares += (long long)mark * mark;
+        }
+        if (on_student != NULL) {
+            StudentGrades grades;
+            ok = student_grades(marks, &buffer, &grades);
+            if (ok) on_student(context, record, &grades);
+        }
+    }
+    grade_buffer_free(&buffer);
+    if (!ok) {
+        free(totals);
         return false;
     }
-    fprintf(file, "ID,Name,Age,Major,MarksData\n"); 
-    for (int i = 0; i < student_count; i++) {
-        string marks_data_str = format_marks_to_string(&students[i]);
-        if (!marks_data_str) {
-            fprintf(stderr, "Error formatting marks for student %s (ID: %s). Data for this student might be lost or incomplete in save.\n", 
-                    students[i].name ? students[i].name : "N/A", 
-                    students[i].id ? students[i].id : "N/A");
-            
-            marks_data_str = string_copy(""); 
-            if (!marks_data_str) { 
-                fprintf(stderr, "CRITICAL: Memory allocation failed for fallback empty marks string. Aborting save for student.\n");
-                continue; 
-            }
+    size_t count = 0;
+    for (size_t symbol = 1; symbol < slots; symbol++) {
+        if (totals[symbol].count == 0) continue;
+        totals[count] = totals[symbol];
+        totals[count++].subject = (Symbol)symbol;
+    }
+    if (count > 1) qsort(totals, count, sizeof(SubjectStats), compare_subject_stats);
+    *subjects = totals;
+    *subject_count = count;
+    return true;
+}
+
+static bool rank_is_word(const char *text, size_t length, const char *word) {
+    if (length != strlen(word)) return false;
+    for (size_t i = 0; i < length; i++) {
+        if (tolower((unsigned char)text[i]) != word[i]) return false;
+    }
+    return true;
+}
+
+// Parses a ranking: a metric, optionally followed by "where <filter>":
+//   age | average | cgpa | S<semester>.<subject> | S<semester>.average | S<semester>.gpa
+// A quoted name after "S<n>." is always a subject, so S1."average" ranks by a
+// subject called average. On failure, describes the problem in `error` and
+// leaves nothing to free; otherwise `filter` is empty when there is no "where".
+bool rank_compile(const char *text, RankMetric *metric, Query *filter, char *error, size_t error_size) {
+    *filter = (Query){ NULL, 0, 0, NULL, 0, 0 };
+    *metric = (RankMetric){ RANK_AGE, 0, SYMBOL_NONE };
+    QueryParser parser = { text, text, filter, error, error_size, false };
+    query_skip_space(&parser);
+    bool ok = true;
+    if (query_at_semester(&parser)) {
+        const char *subject;
+        size_t length;
+        bool quoted;
+        ok = query_parse_semester_subject(&parser, &metric->semester, &metric->subject, &subject, &length, &quoted);
+        metric->kind = RANK_MARK;
+        if (ok && !quoted && rank_is_word(subject, length, "average")) {
+            metric->kind = RANK_SEMESTER_AVERAGE;
+        } else if (ok && !quoted && rank_is_word(subject, length, "gpa")) {
+            metric->kind = RANK_SEMESTER_GPA;
         }
+    } else if (query_accept_word(&parser, "age")) {
+        metric->kind = RANK_AGE;
+    } else if (query_accept_word(&parser, "average")) {
+        metric->kind = RANK_AVERAGE;
+    } else if (query_accept_word(&parser, "cgpa")) {
+        metric->kind = RANK_CGPA;
+    } else {
+        ok = query_fail(&parser, "expected age, average, cgpa or S<semester>.<subject|average|gpa>");
+    }
+    if (ok && query_accept_word(&parser, "where")) ok = query_parse_or(&parser);
+    query_skip_space(&parser);
+    if (ok && *parser.cursor != '\0') ok = query_fail(&parser, "unexpected text");
+    if (!ok) query_free(filter);
+    return ok;
+}
 
-        fprintf(file, "%s,%s,%d,%s,%s\n",
-                students[i].id ? students[i].id : "",
-                students[i].name ? students[i].name : "",
-                students[i].age,
-                students[i].major ? students[i].major : "",
-                marks_data_str ? marks_data_str : ""); 
-        free_string(marks_data_str);
+// The student's value for `metric`; false when there is none (no such mark, or
+// no marks at all for an average).
+static bool rank_metric_value(const RankMetric *metric, int record, double *value) {
+    const MarkList *marks = student_marks(record);
+    uint32_t begin = 0, end = marks->count;
+    switch (metric->kind) {
+        case RANK_AGE:
+            *value = student_age(record);
+            return true;
+        case RANK_MARK: {
+            int mark;
+            if (!mark_list_find_mark(marks, metric->semester, metric->subject, &mark)) return false;
+            *value = mark;
+            return true;
+        }
+        case RANK_SEMESTER_AVERAGE:
+        case RANK_SEMESTER_GPA:
+            if (!mark_list_find_semester(marks, metric->semester, &begin, &end)) return false;
+            break;
+        default:
+            break;
     }
-    if (fclose(file) != 0) {
-        fprintf(stderr, "Error: Could not properly close file %s after writing.\n", filename);
-        return false; 
+    bool points = metric->kind == RANK_CGPA || metric->kind == RANK_SEMESTER_GPA;
+    long long sum = 0;
+    size_t count = 0;
+    for (uint32_t i = begin; i < end; i++) {
+        MarkCell cell = marks->cells[i];
+        if (mark_cell_is_header(cell)) continue;
+        sum += points ? grade_point((int)cell.mark) : (int)cell.mark;
+        count++;
     }
+    if (count == 0) return false;
+    *value = (double)sum / count; // Same division as array_average, so ties agree with the reports.
     return true;
 }
 
-void free_student_marks_memory(Student *s) {
-    for (int i = 0; i < MAX_SEMESTERS; i++) {
-        for (int j = 0; j < s->semesters_data[i].num_subjects_taken; j++) {
-            free_string(s->semesters_data[i].subjects[j].subject_name);
-            s->semesters_data[i].subjects[j].subject_name = NULL;
+// A bounded heap of the best `capacity` entries seen so far, with the worst of
+// them at the root: a new entry only has to beat the root to get in.
+typedef struct {
+    RankEntry *entries;
+    size_t size;
+    size_t capacity;
+    bool highest;
+} RankHeap;
+
+// Whether `a` ranks ahead of `b`. Equal values rank by ascending ID, so the
+// result does not depend on store order or on how the work was split.
+static bool rank_ahead(const RankHeap *heap, RankEntry a, RankEntry b) {
+    if (a.value != b.value) return heap->highest ? a.value > b.value : a.value < b.value;
+    return strcmp(student_id(a.record), student_id(b.record)) < 0;
+}
+
+static void rank_heap_sift_down(RankHeap *heap, size_t at) {
+    RankEntry entry = heap->entries[at];
+    for (;;) {
+        size_t child = 2 * at + 1;
+        if (child >= heap->size) break;
+        if (child + 1 < heap->size && rank_ahead(heap, heap->entries[child], heap->entries[child + 1])) child++;
+        if (!rank_ahead(heap, entry, heap->entries[child])) break;
+        heap->entries[at] = heap->entries[child];
+        at = child;
+    }
+    heap->entries[at] = entry;
+}
+
+// O(log k). Keeps `entry` if the heap has room or it beats the current worst.
+static void rank_heap_offer(RankHeap *heap, RankEntry entry) {
+    if (heap->size < heap->capacity) {
+        size_t at = heap->size++;
+        while (at > 0 && rank_ahead(heap, heap->entries[(at - 1) / 2], entry)) {
+            heap->entries[at] = heap->entries[(at - 1) / 2];
+            at = (at - 1) / 2;
         }
-        s->semesters_data[i].num_subjects_taken = 0; 
-        s->semester_active[i] = false; 
+        heap->entries[at] = entry;
+    } else if (heap->capacity > 0 && rank_ahead(heap, entry, heap->entries[0])) {
+        heap->entries[0] = entry;
+        rank_heap_sift_down(heap, 0);
     }
 }
 
-void free_all_student_memory(void) {
-    for (int i = 0; i < student_count; i++) {
-        free_string(students[i].id); students[i].id = NULL;
-        free_string(students[i].name); students[i].name = NULL;
-        free_string(students[i].major); students[i].major = NULL;
-        free_student_marks_memory(&students[i]);
+// Heapsort in place: repeatedly moves the worst entry to the back, leaving the
+// entries best first. The heap is empty afterwards.
+static void rank_heap_drain(RankHeap *heap) {
+    while (heap->size > 1) {
+        RankEntry worst = heap->entries[0];
+        heap->entries[0] = heap->entries[--heap->size];
+        heap->entries[heap->size] = worst;
+        rank_heap_sift_down(heap, 0);
+    }
+    heap->size = 0;
+}
+
+typedef struct {
+    const RankMetric *metric;
+    const Query *filter;
+    int begin;
+    int end;
+    RankHeap heap;
+} RankWorker;
+
+// Offers every live, matching record in store slots [begin, end) to the
+// worker's own heap. Reads the store only, so workers can run concurrently.
+static void *rank_worker(void *arg) {
+    RankWorker *worker = arg;
+    for (int record = worker->begin; record < worker->end; record++) {
+        RankEntry entry = { 0, record };
+        if (!student_is_live(record) || !rank_metric_value(worker->metric, record, &entry.value)) continue;
+        if (worker->filter->count > 0 && !query_matches(worker->filter, record)) continue;
+        rank_heap_offer(&worker->heap, entry);
+    }
+    return NULL;
+}
+
+static int rank_thread_count(size_t records) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 0 ? (size_t)cpus : 1;
+    if (threads > IMPORT_MAX_THREADS) threads = IMPORT_MAX_THREADS;
+    size_t by_size = records / RANK_MIN_RECORDS_PER_THREAD + 1;
+    return (int)(threads < by_size ? threads : by_size);
+}
+
+// Splits the store into slot ranges, fills a bounded heap per range on its own
+// thread, then offers every survivor to the first heap.
+static bool rank_scan(const RankMetric *metric, const Query *filter, RankHeap *result) {
+    int thread_count = rank_thread_count((size_t)student_store.count);
+    RankWorker workers[IMPORT_MAX_THREADS];
+    pthread_t threads[IMPORT_MAX_THREADS];
+    bool ok = true;
+    for (int t = 0; t < thread_count; t++) {
+        int begin = (int)((long long)student_store.count * t / thread_count);
+        int end = (int)((long long)student_store.count * (t + 1) / thread_count);
+        workers[t] = (RankWorker){ metric, filter, begin, end, { NULL, 0, result->capacity, result->highest } };
+        if (t == 0) workers[t].heap.entries = result->entries;
+        else if ((workers[t].heap.entries = malloc(result->capacity * sizeof(RankEntry))) == NULL) ok = false;
+    }
+    int started = 0;
+    for (int t = 1; ok && t < thread_count; t++, started++) {
+        if (pthread_create(&threads[t], NULL, rank_worker, &workers[t]) != 0) break;
+    }
+    if (ok) {
+        rank_worker(&workers[0]);
+        for (int t = 1; t <= started; t++) pthread_join(threads[t], NULL);
+        for (int t = started + 1; t < thread_count; t++) rank_worker(&workers[t]);
+    }
+    *result = workers[0].heap;
+    for (int t = 1; t < thread_count; t++) {
+        for (size_t i = 0; ok && i < workers[t].heap.size; i++) rank_heap_offer(result, workers[t].heap.entries[i]);
+        free(workers[t].heap.entries);
+    }
+    return ok;
+}
+
+// Walks the subject's posting list from the best mark towards the worst and
+// stops once the heap is full and the next mark cannot beat the root. A
+// posting is only trusted if the record still holds that mark.
+static void rank_by_postings(const RankMetric *metric, const Query *filter, const PostingList *list, RankHeap *heap) {
+    for (size_t n = 0; n < list->size; n++) {
+        const MarkPosting *posting = &list->postings[heap->highest ? list->size - 1 - n : n];
+        if (heap->size == heap->capacity) {
+            double worst = heap->entries[0].value;
+            if (heap->highest ? posting->mark < worst : posting->mark > worst) break;
+        }
+        int mark;
+        if (!student_is_live(posting->record) ||
+            !mark_list_find_mark(student_marks(posting->record), metric->semester, metric->subject, &mark) ||
+            mark != posting->mark) {
+            continue;
+        }
+        if (filter->count > 0 && !query_matches(filter, posting->record)) continue;
+        rank_heap_offer(heap, (RankEntry){ mark, posting->record });
+    }
+}
+
+// The `k` students with the highest (or lowest) value of `metric` among those
+// matching `filter` (empty: everyone), best first, in a malloc'd array (NULL
+// when there are none). Students without a value are left out. O(n log k): a
+// subject mark with a live mark_index walks its posting list; anything else
+// scans the store in parallel chunks, one bounded heap each.
+bool rank_students(const RankMetric *metric, const Query *filter, size_t k, bool highest, RankEntry **entries, size_t *count) {
+    *entries = NULL;
+    *count = 0;
+    size_t live = (size_t)student_count();
+    if (k > live) k = live;
+    if (k == 0 || (metric->kind == RANK_MARK && metric->subject == SYMBOL_NONE)) return true;
+    RankHeap heap = { malloc(k * sizeof(RankEntry)), 0, k, highest };
+    if (heap.entries == NULL) return false;
+    if (metric->kind == RANK_MARK && !mark_index.deferred) {
+        const PostingList *list = mark_index_find(metric->semester, metric->subject);
+        if (list != NULL) rank_by_postings(metric, filter, list, &heap);
+    } else if (!rank_scan(metric, filter, &heap)) {
+        free(heap.entries);
+        return false;
     }
-    student_count = 0;
+    *count = heap.size;
+    rank_heap_drain(&heap);
+    if (*count == 0) free(heap.entries);
+    else *entries = heap.entries;
+    return true;
 }